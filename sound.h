@@ -20,9 +20,15 @@
 #define SOUND_H
 
 #include "sound_global.h"
+#include "sound_avail.h"
 #include "sound_setup.h"
 #include "sound_transfer.h"
 #include "sound_operations.h"
+#include "sound_group.h"
+#include "sound_reactor.h"
+#include "sound_stream.h"
+#include "sound_engine.h"
+#include "sound_share.h"
 #include "sound_parameters.h"
 
 #endif /* SOUND_H */
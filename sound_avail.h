@@ -22,6 +22,9 @@
  * Available calculation
  */
 
+#ifndef SOUND_AVAIL_H
+#define SOUND_AVAIL_H
+
 #include "sound_global.h"
 
 /*
@@ -96,3 +99,5 @@ snd_avail(struct snd *snd)
 	else
 		return playback_avail(snd);
 }
+
+#endif /* SOUND_AVAIL_H */
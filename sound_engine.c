@@ -0,0 +1,319 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pull-model period engine
+ *
+ * The engine owns the loop: it waits until every device
+ * has a period available, then calls process() with
+ * pointers into the mmaped buffers of all devices, and
+ * commits the period. Sync, buffer wrap and xrun recovery
+ * are done here, so application code only processes
+ * frames.
+ *
+ * All devices must be opened with SND_MMAP, interleaved,
+ * with the same rate, and with avail_min not greater than
+ * the engine period (otherwise poll() doesn't wake up in
+ * time).
+ */
+
+#ifdef BUILDING_FOR_GOOGLE_ANDROID
+#include <bits/timespec.h>
+#endif
+
+#include <errno.h>  /* errno */
+#include <poll.h>   /* poll() */
+#include <stdlib.h> /* malloc(), free() */
+
+#include "sound_global.h"
+#include "sound_avail.h"      /* snd_avail() */
+#include "sound_engine.h"
+#include "sound_group.h"
+#include "sound_operations.h" /* snd_sync(), snd_prefill(), ... */
+#include "sound_transfer.h"   /* snd_mmap_begin(), snd_mmap_commit() */
+
+/*
+ * prepare, prefill playback devices and start
+ *
+ * Writing into the mmaped buffer doesn't start a device,
+ * so frames are written between prepare and start.
+ */
+static int
+start_group(struct snd_engine *e)
+{
+	unsigned int i;
+
+	if (snd_group_prepare(&e->group) == -1)
+		return -1;
+
+	for (i = 0; i < e->output_count; i++) {
+		if (snd_prefill(e->outputs[i]) == -1)
+			return -1;
+	}
+
+	return snd_group_trigger(&e->group);
+}
+
+/*
+ * restart the whole group after an xrun
+ *
+ * In a linked group, prepare in one device resets all
+ * of them, so devices are never recovered one by one.
+ * Unlinked devices are restarted too, to keep them in
+ * step.
+ */
+static int
+recover_group(struct snd_engine *e)
+{
+	struct snd **pcms = e->group.pcms;
+	unsigned int i;
+	int xrun = 0;
+	int tmp;
+
+	for (i = 0; i < e->group.count; i++) {
+		tmp = snd_xrun_account(pcms[i]);
+		if (tmp == -1)
+			return -1;
+		xrun |= tmp;
+	}
+
+	if (!xrun)
+		return 0;
+
+	/* running devices can't be prepared */
+	snd_group_stop(&e->group);
+
+	return start_group(e);
+}
+
+/*
+ * wait until all devices have at least a period
+ * available
+ *
+ * Devices in xrun are recovered here.
+ */
+static int
+wait_period(struct snd_engine *e)
+{
+	struct snd **pcms = e->group.pcms;
+	unsigned int count = e->group.count;
+	struct pollfd pfd[count];
+	unsigned int waiting;
+	unsigned int i;
+	int error;
+
+	while (e->running) {
+		waiting = 0;
+		error = 0;
+
+		for (i = 0; i < count; i++) {
+			if (snd_sync(pcms[i], SND_SYNC_GET) < 0)
+				return -1;
+
+			if (snd_is_xrun(pcms[i]))
+				error = 1;
+
+			if (snd_avail(pcms[i]) >= e->period)
+				continue;
+
+			pfd[waiting].fd = pcms[i]->fd;
+			pfd[waiting].events = pcms[i]->type & SND_INPUT ?
+			                      POLLIN : POLLOUT;
+			waiting++;
+		}
+
+		if (error) {
+			if (recover_group(e) == -1)
+				return -1;
+			continue;
+		}
+
+		if (waiting == 0)
+			return 0;
+
+		if (poll(pfd, waiting, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/*
+		 * xrun is handled above. Other errors (e.g.
+		 * disconnected) fail in recover_group(),
+		 * otherwise poll() would return at once again.
+		 */
+		for (i = 0; i < waiting; i++) {
+			if (pfd[i].revents & POLLERR &&
+			    recover_group(e) == -1)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * call process() for a period and commit it
+ *
+ * The period is split at the end of a device buffer. If
+ * process() returns nonzero on the first part, the engine
+ * stops there, only the frames already processed are
+ * committed.
+ */
+static int
+process_period(struct snd_engine *e)
+{
+	void *in[e->input_count ? e->input_count : 1];
+	void *out[e->output_count ? e->output_count : 1];
+	unsigned int remaining = e->period;
+	unsigned int frames;
+	unsigned int i;
+	int ret = 0;
+
+	if (snd_position_snapshot(e->group.pcms[0], &e->time.hw_ptr,
+	                          &e->time.tstamp) == -1)
+		return -1;
+
+	while (remaining && ret == 0) {
+		frames = remaining;
+
+		for (i = 0; i < e->input_count; i++) {
+			in[i] = snd_mmap_begin(e->inputs[i], &frames);
+			if (in[i] == NULL)
+				return -1;
+		}
+		for (i = 0; i < e->output_count; i++) {
+			out[i] = snd_mmap_begin(e->outputs[i], &frames);
+			if (out[i] == NULL)
+				return -1;
+		}
+
+		ret = e->process(in, out, frames, &e->time, e->data);
+
+		for (i = 0; i < e->input_count; i++) {
+			if (snd_mmap_commit(e->inputs[i], frames) == -1)
+				return -1;
+		}
+		for (i = 0; i < e->output_count; i++) {
+			if (snd_mmap_commit(e->outputs[i], frames) == -1)
+				return -1;
+		}
+
+		e->time.frames += frames;
+		remaining -= frames;
+
+		if (ret)
+			e->running = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * start devices and run the engine until process()
+ * returns nonzero or snd_engine_stop() is called
+ *
+ * Playback devices are filled with 'prefill' frames of
+ * silence (the whole buffer if it's zero) between
+ * prepare and start. The same is done after an xrun.
+ */
+int
+snd_engine_run(struct snd_engine *e)
+{
+	int ret = 0;
+
+	e->time.frames = 0;
+	e->running = 1;
+
+	if (start_group(e) == -1)
+		return -1;
+
+	while (e->running) {
+		if (wait_period(e) == -1 || process_period(e) == -1) {
+			ret = -1;
+			break;
+		}
+	}
+
+	snd_group_stop(&e->group);
+
+	return ret;
+}
+
+/*
+ * Setup
+ * =====
+ */
+
+int
+snd_engine_open(struct snd_engine *e, struct snd **pcms, unsigned int count,
+                unsigned int period, snd_engine_process_t process,
+                void *data)
+{
+	unsigned int i;
+
+	if (count == 0 || period == 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (pcms[i]->mmap_buffer == NULL ||
+		    pcms[i]->flags & SND_NONINTERLEAVED ||
+		    period > pcms[i]->buffer_size)
+			return -1;
+	}
+
+	e->inputs = malloc(count * sizeof(*e->inputs));
+	if (!e->inputs)
+		return -1;
+	e->outputs = malloc(count * sizeof(*e->outputs));
+	if (!e->outputs)
+		goto _go_free_inputs;
+
+	e->input_count = 0;
+	e->output_count = 0;
+	for (i = 0; i < count; i++) {
+		if (pcms[i]->type & SND_INPUT)
+			e->inputs[e->input_count++] = pcms[i];
+		else
+			e->outputs[e->output_count++] = pcms[i];
+	}
+
+	if (snd_group_open(&e->group, pcms, count) == -1)
+		goto _go_free_outputs;
+
+	e->period = period;
+	e->process = process;
+	e->data = data;
+	e->running = 0;
+
+	return 0;
+
+_go_free_outputs:
+	free(e->outputs);
+_go_free_inputs:
+	free(e->inputs);
+	return -1;
+}
+
+void
+snd_engine_close(struct snd_engine *e)
+{
+	snd_group_close(&e->group);
+	free(e->outputs);
+	free(e->inputs);
+}
@@ -0,0 +1,99 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOUND_ENGINE_H
+#define SOUND_ENGINE_H
+
+#ifdef BUILDING_FOR_GOOGLE_ANDROID
+#include <bits/timespec.h>
+#endif
+
+#include <time.h> /* struct timespec */
+
+#include "sound_global.h"
+#include "sound_group.h"
+
+/* position of the frames passed to process() */
+struct snd_engine_time {
+	/* frames processed since snd_engine_run() */
+	unsigned long frames;
+
+	/*
+	 * hardware pointer of the first device and when it
+	 * was read
+	 */
+	unsigned long hw_ptr;
+	struct timespec tstamp;
+};
+
+/*
+ * Called once per period. 'in' has a pointer for each
+ * capture device and 'out' a pointer for each playback
+ * device, in the order they were passed to
+ * snd_engine_open(). They point directly into the
+ * mmaped buffers (interleaved frames).
+ *
+ * 'frames' is the period size, except at the end of a
+ * device buffer, where the period is split in two calls.
+ *
+ * Return 0 to continue, anything else stops the engine
+ * (the second call of a split period isn't done).
+ */
+typedef int (*snd_engine_process_t) (void **in, void **out,
+                                     unsigned int frames,
+                                     const struct snd_engine_time *time,
+                                     void *data);
+
+struct snd_engine {
+	struct snd_group group;
+
+	struct snd **inputs;
+	struct snd **outputs;
+	unsigned int input_count;
+	unsigned int output_count;
+
+	/* frames per call to process() */
+	unsigned int period;
+
+	snd_engine_process_t process;
+	void *data;
+
+	struct snd_engine_time time;
+
+	/* snd_engine_run() returns when it's zero */
+	volatile int running;
+};
+
+int
+snd_engine_open(struct snd_engine *e, struct snd **pcms, unsigned int count,
+                unsigned int period, snd_engine_process_t process,
+                void *data);
+
+void
+snd_engine_close(struct snd_engine *e);
+
+int
+snd_engine_run(struct snd_engine *e);
+
+static inline void
+snd_engine_stop(struct snd_engine *e)
+{
+	e->running = 0;
+}
+
+#endif /* SOUND_ENGINE_H */
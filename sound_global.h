@@ -37,6 +37,13 @@
 #define SND_NOIRQ      0x00000020
 /* use CLOCK_MONOTONIC for timestamps */
 #define SND_MONOTONIC  0x00000040
+/* non-interleaved (one buffer per channel) access */
+#define SND_NONINTERLEAVED  0x00000080
+/* recover from xruns in snd_read() and snd_write() */
+#define SND_RECOVER    0x00000100
+
+/* for keeping pointers of different threads apart */
+#define SND_CACHE_LINE  64
 
 /*
  * snd states
@@ -107,9 +114,11 @@ struct snd_config {
 	 * stop_threshold: number of available frames to
 	 * sound device enter in xrun state.
 	 *
-	 * NOTE: As xruns are not being handled, it's set
-	 * to boundary. However, xruns can still occur when
-	 * device returns -1 as its buffer position.
+	 * NOTE: If zero and SND_RECOVER is not set, it's
+	 * set to boundary (xruns are not wanted). However,
+	 * xruns can still occur when device returns -1 as
+	 * its buffer position. If zero and SND_RECOVER is
+	 * set, it's set to buffer size.
 	 */
 	unsigned long stop_threshold;
 
@@ -118,6 +127,54 @@ struct snd_config {
 	 * ahead of application pointer.
 	 */
 	unsigned long silence_threshold;
+
+	/*
+	 * Playback only. Frames to fill with silence. If
+	 * boundary or more (e.g. ULONG_MAX), frames are filled
+	 * with silence as soon as they are played, so a
+	 * device running freely never plays them again.
+	 */
+	unsigned long silence_size;
+
+	/*
+	 * Playback only. Frames of silence written before
+	 * restarting the device after an xrun. If zero,
+	 * device restarts according to start_threshold.
+	 * snd_engine and snd_stream also write it before
+	 * start, the whole buffer if it's zero (see
+	 * snd_prefill()).
+	 */
+	unsigned long prefill;
+};
+
+/*
+ * Xrun accounting
+ * ===============
+ */
+
+struct snd_xrun_stats {
+	/* number of xruns */
+	unsigned long count;
+
+	/* when the last xrun happened (trigger timestamp) */
+	struct timespec tstamp;
+
+	/* estimate of frames lost in all xruns */
+	unsigned long lost_frames;
+};
+
+/*
+ * A buffer in a list of buffers
+ * =============================
+ *
+ * data is the audio and frames is its size. In
+ * non-interleaved access, data is an array of buffers,
+ * one per channel.
+ */
+
+struct snd_buffer {
+	void *data;
+	unsigned int frames;
 };
 
 /*
@@ -136,11 +193,19 @@ struct snd {
 	/* OUTPUT or INPUT */
 	unsigned int type;
 
+	/* flags from snd_config */
+	unsigned int flags;
+
+	unsigned int  channels;
+	unsigned int  bytes_per_sample;
 	unsigned int  bytes_per_frame;
 	unsigned int  buffer_size; /* frames */
 	unsigned long boundary;    /* frames */
+	unsigned int  rate;        /* frames per second */
+	unsigned int  fifo_size;   /* frames in hardware FIFO */
 
 	ssize_t (*transfer) (struct snd*, void*, unsigned int);
+	ssize_t (*transferv) (struct snd*, struct snd_buffer*, unsigned int);
 
 	/*
 	 * Synchronization structures
@@ -169,6 +234,23 @@ struct snd {
 
 	/* sound device buffer to transfer audio */
 	void *mmap_buffer;
+
+	/*
+	 * Only when non-interleaved (SND_NONINTERLEAVED).
+	 * Start address of each channel in mmap_buffer.
+	 * NULL if interleaved.
+	 */
+	void **mmap_areas;
+
+	/*
+	 * Xrun recovery
+	 * =============
+	 */
+
+	/* see prefill in struct snd_config */
+	unsigned long prefill;
+
+	struct snd_xrun_stats xrun;
 };
 
 static inline int
@@ -179,6 +261,12 @@ snd_is_running(struct snd *pcm)
 		 pcm->type == SND_OUTPUT));
 }
 
+static inline int
+snd_is_xrun(struct snd *pcm)
+{
+	return pcm->status->state == SND_STATE_XRUN;
+}
+
 #if 0
 static inline int
 snd_is_empty(struct snd *pcm)
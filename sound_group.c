@@ -0,0 +1,214 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Start and stop several sound devices together
+ *
+ * Useful for full-duplex (capture and playback) and for
+ * multiple cards. When devices are linked with
+ * SNDRV_PCM_IOCTL_LINK, an action (prepare, start, drop)
+ * in one of them is done in all of them atomically.
+ */
+
+#ifdef BUILDING_FOR_GOOGLE_ANDROID
+#include <bits/timespec.h>
+#endif
+
+#include <sys/ioctl.h> /* ioctl() */
+#include <time.h>      /* struct timespec */
+
+/* ALSA header */
+#include <sound/asound.h>
+
+#include "sound_global.h"
+#include "sound_group.h"
+#include "sound_operations.h" /* snd_sync(), snd_trigger(), ... */
+
+static void
+unlink_pcms(struct snd **pcms, unsigned int count)
+{
+	while (count--)
+		ioctl(pcms[count]->fd, SNDRV_PCM_IOCTL_UNLINK);
+}
+
+/*
+ * link all pcms to the first one
+ *
+ * If a link fails (e.g. devices from different cards
+ * whose drivers don't support linking), the group
+ * works unlinked.
+ */
+int
+snd_group_open(struct snd_group *group, struct snd **pcms,
+               unsigned int count)
+{
+	unsigned int i;
+
+	if (count == 0)
+		return -1;
+
+	group->pcms = pcms;
+	group->count = count;
+	group->skew_ns = 0;
+	group->linked = 1;
+
+	for (i = 1; i < count; i++) {
+		if (ioctl(pcms[0]->fd, SNDRV_PCM_IOCTL_LINK,
+		          pcms[i]->fd) == -1) {
+			unlink_pcms(pcms + 1, i - 1);
+			group->linked = 0;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void
+snd_group_close(struct snd_group *group)
+{
+	if (group->linked)
+		unlink_pcms(group->pcms + 1, group->count - 1);
+
+	group->linked = 0;
+}
+
+static long long
+timespec_diff_ns(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000000LL +
+	       (a->tv_nsec - b->tv_nsec);
+}
+
+/* maximum difference between trigger timestamps */
+static long long
+trigger_skew(struct snd_group *group)
+{
+	struct timespec first, last, tstamp;
+	unsigned int i;
+
+	if (snd_trigger_tstamp(group->pcms[0], &first) == -1)
+		return 0;
+	last = first;
+
+	for (i = 1; i < group->count; i++) {
+		if (snd_trigger_tstamp(group->pcms[i], &tstamp) == -1)
+			return 0;
+		if (timespec_diff_ns(&tstamp, &first) < 0)
+			first = tstamp;
+		if (timespec_diff_ns(&tstamp, &last) > 0)
+			last = tstamp;
+	}
+
+	return timespec_diff_ns(&last, &first);
+}
+
+/*
+ * prepare all devices
+ *
+ * Linked: prepare is issued in the first device only.
+ * ALSA does it in the whole group.
+ *
+ * Prepare resets appl_ptr and hw_ptr, they are
+ * synchronized here.
+ */
+int
+snd_group_prepare(struct snd_group *group)
+{
+	unsigned int i;
+
+	if (group->linked &&
+	    ioctl(group->pcms[0]->fd, SNDRV_PCM_IOCTL_PREPARE) == -1)
+		return -1;
+
+	for (i = 0; i < group->count; i++) {
+		if (!group->linked &&
+		    ioctl(group->pcms[i]->fd, SNDRV_PCM_IOCTL_PREPARE) == -1)
+			return -1;
+		if (snd_sync(group->pcms[i], SND_SYNC_GET) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * start all devices, already prepared
+ *
+ * Linked: start is issued in the first device only.
+ *
+ * Unlinked (best effort): starts are issued back to back.
+ */
+int
+snd_group_trigger(struct snd_group *group)
+{
+	unsigned int i;
+
+	if (group->linked) {
+		if (snd_trigger(group->pcms[0]) == -1)
+			return -1;
+	} else {
+		for (i = 0; i < group->count; i++) {
+			if (snd_trigger(group->pcms[i]) == -1)
+				goto _go_stop;
+		}
+	}
+
+	group->skew_ns = trigger_skew(group);
+
+	return 0;
+
+_go_stop:
+	while (i--)
+		snd_stop(group->pcms[i]);
+	return -1;
+}
+
+/*
+ * prepare and start all devices
+ *
+ * In SND_MMAP playback, use snd_group_prepare(), write
+ * frames and then snd_group_trigger() instead, as an
+ * empty device may not start (see snd_prefill()).
+ */
+int
+snd_group_start(struct snd_group *group)
+{
+	if (snd_group_prepare(group) == -1 ||
+	    snd_group_trigger(group) == -1)
+		return -1;
+
+	return 0;
+}
+
+int
+snd_group_stop(struct snd_group *group)
+{
+	unsigned int i;
+	int ret = 0;
+
+	if (group->linked)
+		return snd_stop(group->pcms[0]);
+
+	for (i = 0; i < group->count; i++) {
+		if (snd_stop(group->pcms[i]) == -1)
+			ret = -1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,67 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOUND_GROUP_H
+#define SOUND_GROUP_H
+
+#include "sound_global.h"
+
+/*
+ * group of sound devices started and stopped together
+ * ===================================================
+ *
+ * If ALSA is able to link them, start and stop are
+ * atomic. Otherwise, all devices are prepared and then
+ * started in sequence.
+ */
+
+struct snd_group {
+	struct snd **pcms;
+	unsigned int count;
+
+	/* all pcms are linked to the first one */
+	int linked;
+
+	/*
+	 * maximum difference between trigger timestamps
+	 * after the last snd_group_start() or
+	 * snd_group_trigger()
+	 */
+	long long skew_ns;
+};
+
+int
+snd_group_open(struct snd_group *group, struct snd **pcms,
+               unsigned int count);
+
+void
+snd_group_close(struct snd_group *group);
+
+int
+snd_group_prepare(struct snd_group *group);
+
+int
+snd_group_trigger(struct snd_group *group);
+
+int
+snd_group_start(struct snd_group *group);
+
+int
+snd_group_stop(struct snd_group *group);
+
+#endif /* SOUND_GROUP_H */
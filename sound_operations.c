@@ -29,8 +29,10 @@
 /* ALSA header */
 #include <sound/asound.h>
 
+#include <errno.h>      /* errno */
+#include <string.h>     /* memset() */
 #include <sys/ioctl.h>  /* ioctl() */
-#include <time.h>       /* struct timespec */
+#include <time.h>       /* struct timespec, clock_gettime() */
 
 #include "sound_global.h"
 #include "sound_operations.h" /* SND_SYNC_* */
@@ -66,6 +68,58 @@ snd_sync(struct snd *snd, int flags)
 	return 0;
 }
 
+/*
+ * get hw_ptr and its timestamp consistently
+ *
+ * If status is mmaped, no ioctl() is done. ALSA may
+ * update status while it's being read, so hw_ptr and
+ * tstamp are read until two readings agree.
+ *
+ * NOTE: ALSA writes hw_ptr before tstamp, and there
+ * is no sequence counter in status. Two readings that
+ * agree only mean neither changed while they were
+ * taken. If they fall between ALSA's write of hw_ptr
+ * and its write of tstamp, the new hw_ptr is returned
+ * with the previous tstamp. A pair from two different
+ * completed updates is never returned.
+ *
+ * If status isn't mmaped, it's synchronized via
+ * ioctl().
+ */
+int
+snd_position_snapshot(struct snd *pcm, unsigned long *hw_ptr,
+                      struct timespec *tstamp)
+{
+	volatile struct snd_pcm_mmap_status *status = pcm->status;
+	unsigned long ptr;
+	struct timespec ts;
+
+	if (pcm->sync_ptr != NULL) {
+		if (snd_sync(pcm, SND_SYNC_GET) < 0)
+			return -1;
+
+		*hw_ptr = pcm->status->hw_ptr;
+		*tstamp = pcm->status->tstamp;
+
+		return 0;
+	}
+
+	do {
+		ts.tv_sec = status->tstamp.tv_sec;
+		ts.tv_nsec = status->tstamp.tv_nsec;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		ptr = status->hw_ptr;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (ptr != status->hw_ptr ||
+	         ts.tv_sec != status->tstamp.tv_sec ||
+	         ts.tv_nsec != status->tstamp.tv_nsec);
+
+	*hw_ptr = ptr;
+	*tstamp = ts;
+
+	return 0;
+}
+
 /*
  * Start and drop actions
  * ======================
@@ -81,6 +135,34 @@ snd_start(struct snd *pcm)
 	return 0;
 }
 
+/*
+ * prepare only, so frames can be written before start
+ *
+ * Prepare resets appl_ptr and hw_ptr, they are
+ * synchronized here.
+ */
+int
+snd_prepare(struct snd *pcm)
+{
+	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_PREPARE) == -1)
+		return -1;
+
+	if (snd_sync(pcm, SND_SYNC_GET) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* start a prepared device */
+int
+snd_trigger(struct snd *pcm)
+{
+	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_START) == -1)
+		return -1;
+
+	return 0;
+}
+
 /* DROP is internally the stop action */
 int
 snd_stop(struct snd *pcm)
@@ -117,3 +199,239 @@ snd_trigger_tstamp(struct snd *pcm, struct timespec *tstamp)
 
 	return 0;
 }
+
+/*
+ * About SNDRV_PCM_IOCTL_STATUS_EXT ioctl
+ * ======================================
+ *
+ * Same as STATUS, but audio_tstamp_data is read by ALSA.
+ * It tells the type of audio timestamp requested (bits
+ * 0-3) and whether delay must be reported in it (bit 4).
+ *
+ * ALSA writes the report in the upper 16 bits: valid
+ * (bit 0), actual type (bits 1-4) and whether accuracy
+ * is reported (bit 5).
+ */
+
+#define AUDIO_TSTAMP_REPORT_DELAY  (1 << 4)
+
+#define audio_tstamp_valid(data)     (((data) >> 16) & 1)
+#define audio_tstamp_type(data)      (((data) >> 17) & 0xf)
+#define audio_tstamp_accuracy(data)  (((data) >> 21) & 1)
+
+/*
+ * get system and audio timestamps, delay and avail
+ * together
+ *
+ * If driver doesn't support the requested type, ALSA
+ * falls back to the default one (see tstamp->type).
+ */
+int
+snd_audio_tstamp(struct snd *pcm, unsigned int type,
+                 struct snd_audio_tstamp *tstamp)
+{
+	struct snd_pcm_status status;
+
+	memset(&status, 0, sizeof(status));
+	status.audio_tstamp_data = (type & 0xf) | AUDIO_TSTAMP_REPORT_DELAY;
+
+	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_STATUS_EXT, &status) < 0) {
+		/* kernels older than 4.4 */
+		memset(&status, 0, sizeof(status));
+		if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_STATUS, &status) < 0)
+			return -1;
+	}
+
+	tstamp->system = status.tstamp;
+	tstamp->audio = status.audio_tstamp;
+	tstamp->delay = status.delay;
+	tstamp->avail = status.avail;
+
+	if (audio_tstamp_valid(status.audio_tstamp_data))
+		tstamp->type = audio_tstamp_type(status.audio_tstamp_data);
+	else
+		tstamp->type = SND_AUDIO_TSTAMP_DEFAULT;
+
+	if (audio_tstamp_accuracy(status.audio_tstamp_data))
+		tstamp->accuracy = status.audio_tstamp_accuracy;
+	else
+		tstamp->accuracy = 0;
+
+	return 0;
+}
+
+/*
+ * get delay: frames between application pointer and
+ * the speaker (playback) or the microphone (capture)
+ */
+int
+snd_delay(struct snd *pcm, long *delay)
+{
+	snd_pcm_sframes_t d;
+
+	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_DELAY, &d) < 0)
+		return -1;
+
+	*delay = d;
+
+	return 0;
+}
+
+/*
+ * Xrun recovery
+ * =============
+ */
+
+/* zeros to fill with silence */
+static const char silence[4096];
+
+/*
+ * write frames of silence at appl_ptr
+ *
+ * NOTE: Zero is silence only for signed formats.
+ */
+int
+snd_write_silence(struct snd *pcm, unsigned long frames)
+{
+	void *bufs[pcm->channels];
+	void *buffer;
+	unsigned int chunk;
+	unsigned int i;
+	ssize_t tmp;
+
+	if (pcm->flags & SND_NONINTERLEAVED) {
+		for (i = 0; i < pcm->channels; i++)
+			bufs[i] = (void*) silence;
+		buffer = bufs;
+		chunk = sizeof(silence) / pcm->bytes_per_sample;
+	} else {
+		buffer = (void*) silence;
+		chunk = sizeof(silence) / pcm->bytes_per_frame;
+	}
+
+	while (frames) {
+		tmp = pcm->transfer(pcm, buffer,
+		                    frames < chunk ? frames : chunk);
+		if (tmp <= 0)
+			return -1;
+		frames -= tmp;
+	}
+
+	return 0;
+}
+
+/* frames elapsed since tstamp, in the clock of timestamps */
+static unsigned long
+frames_since(struct snd *pcm, struct timespec *tstamp)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(pcm->flags & SND_MONOTONIC ?
+	              CLOCK_MONOTONIC : CLOCK_REALTIME, &now);
+
+	ns = (now.tv_sec - tstamp->tv_sec) * 1000000000LL +
+	     (now.tv_nsec - tstamp->tv_nsec);
+	if (ns < 0)
+		return 0;
+
+	return ns * pcm->rate / 1000000000LL;
+}
+
+/*
+ * write the silence a playback device starts with:
+ * 'prefill' frames, or the whole buffer if it's zero
+ *
+ * In SND_MMAP access, writing doesn't start the device,
+ * and starting an empty one with stop_threshold below
+ * boundary fails with EPIPE.
+ */
+int
+snd_prefill(struct snd *pcm)
+{
+	return snd_write_silence(pcm, pcm->prefill ?
+	                         pcm->prefill : pcm->buffer_size);
+}
+
+/*
+ * account an xrun in pcm->xrun, if device is in one
+ *
+ * Return 1 if device is in xrun and 0 if it's fine. A
+ * device that can't be recovered returns -1 with errno
+ * set to ENODEV (disconnected), ESTRPIPE (suspended) or
+ * EBADFD (not prepared).
+ */
+int
+snd_xrun_account(struct snd *pcm)
+{
+	struct snd_pcm_status status;
+
+	memset(&status, 0, sizeof(status));
+	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_STATUS, &status) == -1)
+		return -1;
+
+	switch (status.state) {
+	case SND_STATE_XRUN:
+		break;
+	case SND_STATE_DISCONNECTED:
+		errno = ENODEV;
+		return -1;
+	case SND_STATE_SUSPENDED:
+		errno = ESTRPIPE;
+		return -1;
+	case SND_STATE_OPEN:
+	case SND_STATE_SETUP:
+		errno = EBADFD;
+		return -1;
+	default:
+		return 0;
+	}
+
+	/* trigger timestamp was set when the xrun happened */
+	pcm->xrun.count++;
+	pcm->xrun.tstamp = status.trigger_tstamp;
+	pcm->xrun.lost_frames += frames_since(pcm, &status.trigger_tstamp);
+
+	return 1;
+}
+
+/*
+ * recover from an xrun
+ *
+ * The xrun is accounted in pcm->xrun, then the device is
+ * prepared. In playback, 'prefill' frames of silence are
+ * written and the device is started (if prefill is zero,
+ * start_threshold starts it later). In capture, device is
+ * started right away.
+ *
+ * Return 0 if there was nothing to recover or recovery
+ * has succeeded, -1 otherwise (see snd_xrun_account()).
+ */
+int
+snd_recover(struct snd *pcm)
+{
+	int tmp;
+
+	tmp = snd_xrun_account(pcm);
+	if (tmp <= 0)
+		return tmp;
+
+	if (snd_prepare(pcm) == -1)
+		return -1;
+
+	if (pcm->type == SND_OUTPUT && pcm->prefill &&
+	    snd_write_silence(pcm, pcm->prefill) == -1)
+		return -1;
+
+	if (pcm->type == SND_OUTPUT && !pcm->prefill)
+		return 0;
+
+	/* a RW transfer may have started the device already */
+	if (snd_sync(pcm, SND_SYNC_GET) < 0)
+		return -1;
+	if (pcm->status->state == SND_STATE_PREPARED &&
+	    snd_trigger(pcm) == -1)
+		return -1;
+
+	return 0;
+}
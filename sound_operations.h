@@ -41,16 +41,81 @@
 /* request hardware pointer update */
 #define SND_SYNC_HW  SNDRV_PCM_SYNC_PTR_HWSYNC
 
+/*
+ * audio timestamp types for snd_audio_tstamp()
+ * ============================================
+ *
+ * DEFAULT: DMA time, reported as per hw_ptr.
+ * LINK: link time (sample or wallclock counter), reset on start.
+ * LINK_ABSOLUTE: link time, not reset on start.
+ * LINK_ESTIMATED: link time estimated indirectly.
+ */
+
+#define SND_AUDIO_TSTAMP_DEFAULT  SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT
+#define SND_AUDIO_TSTAMP_LINK     SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK
+#define SND_AUDIO_TSTAMP_LINK_ABSOLUTE \
+	SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE
+#define SND_AUDIO_TSTAMP_LINK_ESTIMATED \
+	SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED
+
+struct snd_audio_tstamp {
+	/* system time when audio timestamp was taken */
+	struct timespec system;
+
+	/* audio time (see type) */
+	struct timespec audio;
+
+	/* frames between application pointer and the speaker/mic */
+	long delay;
+
+	unsigned long avail;
+
+	/* type actually reported by driver */
+	unsigned int type;
+
+	/* accuracy of audio timestamp in ns, zero if unknown */
+	unsigned int accuracy;
+};
+
 int
 snd_sync(struct snd *pcm, int flags);
 
+int
+snd_position_snapshot(struct snd *pcm, unsigned long *hw_ptr,
+                      struct timespec *tstamp);
+
 int
 snd_start(struct snd *pcm);
 
+int
+snd_prepare(struct snd *pcm);
+
+int
+snd_trigger(struct snd *pcm);
+
 int
 snd_stop(struct snd *pcm);
 
 int
 snd_trigger_tstamp(struct snd *pcm, struct timespec *tstamp);
 
+int
+snd_audio_tstamp(struct snd *pcm, unsigned int type,
+                 struct snd_audio_tstamp *tstamp);
+
+int
+snd_delay(struct snd *pcm, long *delay);
+
+int
+snd_write_silence(struct snd *pcm, unsigned long frames);
+
+int
+snd_prefill(struct snd *pcm);
+
+int
+snd_xrun_account(struct snd *pcm);
+
+int
+snd_recover(struct snd *pcm);
+
 #endif /* SOUND_OPERATIONS_H */
@@ -36,17 +36,20 @@ struct snd_parameters {
  * masks
  * =====
  *
- * - ACCESS: MMAP or RW. At the moment only interleaved is
- *   supported.
+ * - ACCESS: MMAP or RW. Interleaved (frames in sequence) or
+ *   non-interleaved (one buffer per channel).
  *
- * - FORMAT: 8-bit, 16-bit and 32-bit. Little or Big
- *   endian. Unsigned or Signed.
+ * - FORMAT: 8-bit, 16-bit, 24-bit and 32-bit. Little or
+ *   Big endian. Unsigned or Signed. 24-bit either packed
+ *   in 3 bytes or in the low bits of 4 bytes. 32-bit float.
  */
 
 /* ACCESS */
 #define SND_ACCESS        SNDRV_PCM_HW_PARAM_ACCESS
 #define SND_ACCESS_MMAP   SNDRV_PCM_ACCESS_MMAP_INTERLEAVED
 #define SND_ACCESS_RW     SNDRV_PCM_ACCESS_RW_INTERLEAVED
+#define SND_ACCESS_MMAP_NONINTERLEAVED  SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED
+#define SND_ACCESS_RW_NONINTERLEAVED    SNDRV_PCM_ACCESS_RW_NONINTERLEAVED
 
 /* FORMAT */
 #define SND_FORMAT         SNDRV_PCM_HW_PARAM_FORMAT
@@ -60,6 +63,9 @@ struct snd_parameters {
 #define SND_FORMAT_S32_BE  SNDRV_PCM_FORMAT_S32_BE
 #define SND_FORMAT_U32_LE  SNDRV_PCM_FORMAT_U32_LE
 #define SND_FORMAT_U32_BE  SNDRV_PCM_FORMAT_U32_BE
+#define SND_FORMAT_S24_LE  SNDRV_PCM_FORMAT_S24_LE
+#define SND_FORMAT_S24_3LE SNDRV_PCM_FORMAT_S24_3LE
+#define SND_FORMAT_FLOAT_LE  SNDRV_PCM_FORMAT_FLOAT_LE
 
 /*
  * intervals
@@ -146,6 +152,10 @@ snd_format_to_bytes(unsigned int format)
 	case SND_FORMAT_U16_LE:
 	case SND_FORMAT_U16_BE:
 		return 2;
+	case SND_FORMAT_S24_3LE:
+		return 3;
+	case SND_FORMAT_S24_LE:
+	case SND_FORMAT_FLOAT_LE:
 	case SND_FORMAT_S32_LE:
 	case SND_FORMAT_S32_BE:
 	case SND_FORMAT_U32_LE:
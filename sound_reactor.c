@@ -0,0 +1,233 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Service many sound devices (and timers) from one thread
+ *
+ * All file descriptors are in one epoll set. When a
+ * sound device is ready, its refill callback is called
+ * with the available frames.
+ *
+ * ALSA poll semantics:
+ *
+ * - POLLOUT (playback) or POLLIN (capture): avail is
+ *   greater than or equal to avail_min.
+ *
+ * - POLLERR: device is not running or preparing. It's
+ *   usually an xrun, so snd_recover() is tried. If the
+ *   device is disconnected, suspended or not prepared,
+ *   it fails and the source is removed, otherwise epoll
+ *   would report the error again and again.
+ */
+
+#include <errno.h>     /* errno */
+#include <stdint.h>    /* uint64_t */
+#include <sys/epoll.h> /* epoll_*() */
+#include <unistd.h>    /* read(), close() */
+
+#include "sound_global.h"
+#include "sound_avail.h"      /* snd_avail() */
+#include "sound_operations.h" /* snd_sync(), snd_recover() */
+#include "sound_reactor.h"
+
+#define MAX_EVENTS  32
+
+int
+snd_reactor_open(struct snd_reactor *r)
+{
+	r->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->fd == -1)
+		return -1;
+
+	r->running = 0;
+	r->failed = NULL;
+	r->batch = NULL;
+	r->batch_count = 0;
+
+	return 0;
+}
+
+void
+snd_reactor_close(struct snd_reactor *r)
+{
+	close(r->fd);
+}
+
+static int
+add_source(struct snd_reactor *r, struct snd_reactor_source *src,
+           unsigned int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = src;
+
+	src->error = 0;
+
+	return epoll_ctl(r->fd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+int
+snd_reactor_add_snd(struct snd_reactor *r, struct snd_reactor_source *src,
+                    struct snd *snd,
+                    int (*refill) (struct snd*, unsigned long, void*),
+                    void *data)
+{
+	src->fd = snd->fd;
+	src->snd = snd;
+	src->refill = refill;
+	src->timer = NULL;
+	src->data = data;
+
+	return add_source(r, src, snd->type & SND_INPUT ? EPOLLIN : EPOLLOUT);
+}
+
+int
+snd_reactor_add_timer(struct snd_reactor *r, struct snd_reactor_source *src,
+                      int fd, int (*timer) (uint64_t, void*), void *data)
+{
+	src->fd = fd;
+	src->snd = NULL;
+	src->refill = NULL;
+	src->timer = timer;
+	src->data = data;
+
+	return add_source(r, src, EPOLLIN);
+}
+
+/*
+ * remove a source, also from the events being dispatched
+ *
+ * src->fd is -1 afterwards.
+ */
+int
+snd_reactor_remove(struct snd_reactor *r, struct snd_reactor_source *src)
+{
+	int tmp;
+	int i;
+
+	tmp = epoll_ctl(r->fd, EPOLL_CTL_DEL, src->fd, NULL);
+	src->fd = -1;
+
+	for (i = 0; i < r->batch_count; i++) {
+		if (r->batch[i].data.ptr == src)
+			r->batch[i].data.ptr = NULL;
+	}
+
+	return tmp;
+}
+
+static int
+handle_timer(struct snd_reactor_source *src)
+{
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof(expirations)) == -1)
+		return errno == EAGAIN ? 0 : -1;
+
+	return src->timer(expirations, src->data);
+}
+
+static int
+handle_snd(struct snd_reactor_source *src, unsigned int events)
+{
+	struct snd *snd = src->snd;
+
+	if (events & EPOLLERR && snd_recover(snd) == -1)
+		return -1;
+
+	/* no ioctl() if status and control are mmaped */
+	if (snd_sync(snd, SND_SYNC_GET) < 0)
+		return -1;
+
+	return src->refill(snd, snd_avail(snd), src->data);
+}
+
+/*
+ * wait up to 'timeout' milliseconds (-1 is forever) and
+ * dispatch ready sources
+ *
+ * A source that fails is removed, its errno is kept in
+ * src->error and r->failed points to it (the last one).
+ * Return the number of events handled.
+ */
+int
+snd_reactor_dispatch(struct snd_reactor *r, int timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct snd_reactor_source *src;
+	int n;
+	int i;
+	int tmp;
+
+	n = epoll_wait(r->fd, events, MAX_EVENTS, timeout);
+	if (n == -1)
+		return errno == EINTR ? 0 : -1;
+
+	r->batch = events;
+	r->batch_count = n;
+
+	for (i = 0; i < n; i++) {
+		/* removed by a callback */
+		src = events[i].data.ptr;
+		if (src == NULL)
+			continue;
+
+		errno = 0;
+		if (src->snd)
+			tmp = handle_snd(src, events[i].events);
+		else
+			tmp = handle_timer(src);
+
+		if (tmp == -1) {
+			src->error = errno;
+			snd_reactor_remove(r, src);
+			r->failed = src;
+		}
+	}
+
+	r->batch = NULL;
+	r->batch_count = 0;
+
+	return n;
+}
+
+/*
+ * dispatch until snd_reactor_stop() or a source fails
+ *
+ * If a source fails, -1 is returned with errno set to
+ * its error, and r->failed points to it.
+ */
+int
+snd_reactor_run(struct snd_reactor *r)
+{
+	r->running = 1;
+	r->failed = NULL;
+
+	while (r->running) {
+		if (snd_reactor_dispatch(r, -1) == -1)
+			return -1;
+
+		if (r->failed) {
+			errno = r->failed->error;
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOUND_REACTOR_H
+#define SOUND_REACTOR_H
+
+#include <stdint.h> /* uint64_t */
+
+#include "sound_global.h"
+
+struct epoll_event;
+
+/*
+ * A source of events
+ * ==================
+ *
+ * Either a sound device (snd is set) or a timerfd. It's
+ * allocated by the user and must live while registered.
+ *
+ * A callback may remove any source, it's not dispatched
+ * anymore, even if it has an event in the current batch.
+ * Free a source only after the snd_reactor_dispatch()
+ * that removed it returns.
+ */
+
+struct snd_reactor_source {
+	int fd;
+
+	/* NULL if source is a timer */
+	struct snd *snd;
+
+	/*
+	 * Sound device: called when it's ready, with the
+	 * available frames. If it returns -1, the source is
+	 * removed.
+	 */
+	int (*refill) (struct snd *snd, unsigned long avail, void *data);
+
+	/* Timer: called with the number of expirations */
+	int (*timer) (uint64_t expirations, void *data);
+
+	void *data;
+
+	/*
+	 * errno of the failure that removed the source, or
+	 * zero
+	 */
+	int error;
+};
+
+/*
+ * The reactor
+ * ===========
+ */
+
+struct snd_reactor {
+	/* epoll file descriptor */
+	int fd;
+
+	/* snd_reactor_run() returns when it's zero */
+	volatile int running;
+
+	/* last source removed because it failed, or NULL */
+	struct snd_reactor_source *failed;
+
+	/* events being dispatched, see snd_reactor_remove() */
+	struct epoll_event *batch;
+	int batch_count;
+};
+
+int
+snd_reactor_open(struct snd_reactor *r);
+
+void
+snd_reactor_close(struct snd_reactor *r);
+
+int
+snd_reactor_add_snd(struct snd_reactor *r, struct snd_reactor_source *src,
+                    struct snd *snd,
+                    int (*refill) (struct snd*, unsigned long, void*),
+                    void *data);
+
+int
+snd_reactor_add_timer(struct snd_reactor *r, struct snd_reactor_source *src,
+                      int fd, int (*timer) (uint64_t, void*), void *data);
+
+int
+snd_reactor_remove(struct snd_reactor *r, struct snd_reactor_source *src);
+
+int
+snd_reactor_dispatch(struct snd_reactor *r, int timeout);
+
+int
+snd_reactor_run(struct snd_reactor *r);
+
+static inline void
+snd_reactor_stop(struct snd_reactor *r)
+{
+	r->running = 0;
+}
+
+#endif /* SOUND_REACTOR_H */
@@ -27,8 +27,10 @@
 #endif
 
 #include <assert.h>    /* assert() */
+#include <errno.h>     /* errno */
 #include <limits.h>    /* ULONG_MAX */
 #include <stdio.h>     /* snprintf() */
+#include <stdlib.h>    /* calloc(), free() */
 #include <string.h>    /* memset() */
 #include <sys/ioctl.h> /* ioctl() */
 #include <sys/mman.h>  /* mmap() */
@@ -40,6 +42,7 @@
 #include "sound_global.h"
 #include "hardware_parameters.h" /* hw_param_*() */
 #include "sound_open_device.h"   /* sound_device_open() */
+#include "sound_operations.h"    /* snd_sync() */
 #include "sound_parameters.h"    /* sound_frames_to_bytes(), SND_* */
 #include "sound_transfer.h"      /* snd_*_transfer() */
 
@@ -47,6 +50,19 @@
 #define page_align(size) \
 	( size + (size % PAGE_SIZE ? PAGE_SIZE - size % PAGE_SIZE : 0) )
 
+/* keep the parameters needed by transfers */
+static void
+save_parameters(struct snd *pcm, const struct snd_config *config)
+{
+	pcm->type = config->flags & SND_INPUT;
+	pcm->flags = config->flags;
+	pcm->channels = config->channels;
+	pcm->bytes_per_sample = snd_format_to_bytes(config->format);
+	pcm->bytes_per_frame = config->channels * pcm->bytes_per_sample;
+	pcm->buffer_size = config->period_count * config->period_size;
+	pcm->rate = config->rate;
+}
+
 static int
 set_hardware_parameters(struct snd *pcm, struct snd_config *config)
 {
@@ -58,11 +74,20 @@ set_hardware_parameters(struct snd *pcm, struct snd_config *config)
 	if (config->flags & SND_NOIRQ)
 		hw_params.flags |= SND_NO_INTERRUPTS;
 
-	/* set the access type (MMAP interleaved or RW interleaved) */
-	if (config->flags & SND_MMAP)
-		hw_param_set(&hw_params, SND_ACCESS, SND_ACCESS_MMAP);
-	else
-		hw_param_set(&hw_params, SND_ACCESS, SND_ACCESS_RW);
+	/* set the access type (MMAP or RW, interleaved or not) */
+	if (config->flags & SND_MMAP) {
+		if (config->flags & SND_NONINTERLEAVED)
+			hw_param_set(&hw_params, SND_ACCESS,
+			             SND_ACCESS_MMAP_NONINTERLEAVED);
+		else
+			hw_param_set(&hw_params, SND_ACCESS, SND_ACCESS_MMAP);
+	} else {
+		if (config->flags & SND_NONINTERLEAVED)
+			hw_param_set(&hw_params, SND_ACCESS,
+			             SND_ACCESS_RW_NONINTERLEAVED);
+		else
+			hw_param_set(&hw_params, SND_ACCESS, SND_ACCESS_RW);
+	}
 
 	/*
 	 * we don't need to set subformat because there
@@ -95,9 +120,8 @@ set_hardware_parameters(struct snd *pcm, struct snd_config *config)
 
 	/* NOTE: we assume parameters have not changed */
 
-	pcm->bytes_per_frame =
-	  config->channels * snd_format_to_bytes(config->format);
-	pcm->buffer_size = config->period_count * config->period_size;
+	save_parameters(pcm, config);
+	pcm->fifo_size = hw_params.fifo_size;
 
 	return 0;
 }
@@ -126,7 +150,10 @@ set_software_parameters(struct snd *pcm, struct snd_config *config)
 	if (!config->start_threshold)
 		config->start_threshold = 1;
 
-	if (!config->stop_threshold)
+	if (!config->stop_threshold && config->flags & SND_RECOVER)
+		/* xrun when buffer is empty (playback) or full (capture) */
+		config->stop_threshold = pcm->buffer_size;
+	else if (!config->stop_threshold)
 		/*
 		 * we won't have xruns! except if device
 		 * returns -1 in internal pointer callback
@@ -138,7 +165,7 @@ set_software_parameters(struct snd *pcm, struct snd_config *config)
 	sw_params.start_threshold = config->start_threshold;
 	sw_params.stop_threshold = config->stop_threshold;
 	sw_params.silence_threshold = config->silence_threshold;
-	sw_params.silence_size = 0;
+	sw_params.silence_size = config->silence_size;
 
 	if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_SW_PARAMS, &sw_params))
 		return -1;
@@ -252,6 +279,50 @@ setup_mmap_buffer(struct snd *pcm)
 	return 0;
 }
 
+static void
+cleanup_mmap_areas(struct snd *pcm)
+{
+	free(pcm->mmap_areas);
+	pcm->mmap_areas = NULL;
+}
+
+/*
+ * get the start address of each channel in mmap buffer
+ *
+ * Only for non-interleaved access. Samples of a channel
+ * must be continuous (i.e. step equals sample size).
+ */
+static int
+setup_mmap_areas(struct snd *pcm)
+{
+	struct snd_pcm_channel_info info;
+	unsigned int i;
+
+	pcm->mmap_areas = calloc(pcm->channels, sizeof(*pcm->mmap_areas));
+	if (!pcm->mmap_areas)
+		return -1;
+
+	for (i = 0; i < pcm->channels; i++) {
+		memset(&info, 0, sizeof(info));
+		info.channel = i;
+		if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_CHANNEL_INFO, &info) == -1)
+			goto _go_free;
+
+		if (info.step != pcm->bytes_per_sample * 8 || info.first % 8)
+			goto _go_free;
+
+		pcm->mmap_areas[i] = (char*) pcm->mmap_buffer +
+		                     info.offset - SNDRV_PCM_MMAP_OFFSET_DATA +
+		                     info.first / 8;
+	}
+
+	return 0;
+
+_go_free:
+	cleanup_mmap_areas(pcm);
+	return -1;
+}
+
 void
 snd_close(struct snd *pcm)
 {
@@ -259,12 +330,78 @@ snd_close(struct snd *pcm)
 
 	if (pcm->mmap_buffer != NULL) {
 		ioctl(pcm->fd, SNDRV_PCM_IOCTL_DROP);
+		cleanup_mmap_areas(pcm);
+		cleanup_mmap_buffer(pcm);
+	}
+
+	close(pcm->fd);
+}
+
+/* like snd_close(), but the device is left running */
+void
+snd_detach(struct snd *pcm)
+{
+	cleanup_control_and_status(pcm);
+
+	if (pcm->mmap_buffer != NULL) {
+		cleanup_mmap_areas(pcm);
 		cleanup_mmap_buffer(pcm);
 	}
 
 	close(pcm->fd);
 }
 
+/*
+ * set up pcm for a sound device already opened and
+ * configured by snd_open() with SND_MMAP, usually in
+ * another process that has passed the file descriptor.
+ *
+ * 'config' and 'boundary' must be the ones of that
+ * snd_open(). Parameters are not set again, and state
+ * (e.g. running) is the one of the device.
+ */
+int
+snd_attach(struct snd *pcm, int fd, const struct snd_config *config,
+           unsigned long boundary)
+{
+	if (!(config->flags & SND_MMAP)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(pcm, 0, sizeof(*pcm));
+
+	pcm->fd = fd;
+	save_parameters(pcm, config);
+	pcm->boundary = boundary;
+	pcm->prefill = config->prefill;
+
+	if (setup_mmap_buffer(pcm) == -1)
+		return -1;
+	if (config->flags & SND_NONINTERLEAVED && setup_mmap_areas(pcm) == -1)
+		goto _go_unmap_buffer;
+
+	if (setup_control_and_status(pcm) < 0)
+		goto _go_cleanup_areas;
+
+	pcm->transfer = snd_mmap_transfer;
+	pcm->transferv = snd_mmap_transfer_batch;
+
+	/* control isn't shared if it isn't mmaped */
+	if (snd_sync(pcm, SND_SYNC_GET) < 0)
+		goto _go_cleanup_status;
+
+	return 0;
+
+_go_cleanup_status:
+	cleanup_control_and_status(pcm);
+_go_cleanup_areas:
+	cleanup_mmap_areas(pcm);
+_go_unmap_buffer:
+	cleanup_mmap_buffer(pcm);
+	return -1;
+}
+
 int
 snd_open(struct snd *pcm, struct snd_config *config)
 {
@@ -276,8 +413,6 @@ snd_open(struct snd *pcm, struct snd_config *config)
 	if (pcm->fd == -1)
 		return -1;
 
-	pcm->type = config->flags & SND_INPUT;
-
 	if (set_hardware_parameters(pcm, config) == -1)
 		goto _go_close_device;
 	if (set_software_parameters(pcm, config) == -1)
@@ -287,10 +422,20 @@ snd_open(struct snd *pcm, struct snd_config *config)
 	if (config->flags & SND_MMAP) {
 		if (setup_mmap_buffer(pcm) == -1)
 			goto _go_close_device;
+		if (config->flags & SND_NONINTERLEAVED &&
+		    setup_mmap_areas(pcm) == -1) {
+			cleanup_mmap_buffer(pcm);
+			goto _go_close_device;
+		}
 		pcm->transfer = snd_mmap_transfer;
+		pcm->transferv = snd_mmap_transfer_batch;
 	} else {
 		pcm->mmap_buffer = NULL;
-		pcm->transfer = snd_ioctl_transfer;
+		if (config->flags & SND_NONINTERLEAVED)
+			pcm->transfer = snd_ioctl_transfer_n;
+		else
+			pcm->transfer = snd_ioctl_transfer;
+		pcm->transferv = snd_ioctl_transferv;
 	}
 
 	/* mmap or allocate status and control areas */
@@ -301,17 +446,24 @@ snd_open(struct snd *pcm, struct snd_config *config)
 	pcm->control->appl_ptr = 0;
 	pcm->control->avail_min = config->avail_min;
 
+	pcm->prefill = config->prefill;
+	if (pcm->prefill > pcm->buffer_size)
+		pcm->prefill = pcm->buffer_size;
+
 	/*
-	 * NOTE: xruns are not being handled! User must
-	 * set stop_threshold to 0, then it's set to
-	 * ULONG_MAX in set_software_parameters()
+	 * NOTE: xruns are handled only if SND_RECOVER is
+	 * set. Otherwise, user must set stop_threshold to
+	 * 0, then it's set to ULONG_MAX in
+	 * set_software_parameters()
 	 */
 
 	return 0;
 
 _go_unmap_buffer:
-	if (config->flags & SND_MMAP)
+	if (config->flags & SND_MMAP) {
+		cleanup_mmap_areas(pcm);
 		cleanup_mmap_buffer(pcm);
+	}
 _go_close_device:
 	close(pcm->fd);
 	return -1;
@@ -27,4 +27,11 @@ snd_close(struct snd *pcm);
 int
 snd_open(struct snd *pcm, struct snd_config *config);
 
+void
+snd_detach(struct snd *pcm);
+
+int
+snd_attach(struct snd *pcm, int fd, const struct snd_config *config,
+           unsigned long boundary);
+
 #endif /* SOUND_SETUP_H */
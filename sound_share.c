@@ -0,0 +1,969 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Share a sound device between processes
+ *
+ * The first process to open a device becomes its owner:
+ * it opens the device, creates the shared area (memfd)
+ * and listens on an abstract Unix socket named after the
+ * device. Other processes connect to the socket and
+ * receive the device and area file descriptors
+ * (SCM_RIGHTS), then mmap the same buffers. After that,
+ * the socket is not used anymore.
+ *
+ * The device runs freely (no xruns), looping over its
+ * buffer. In playback, each process keeps its own
+ * position and adds its samples to a sum buffer with
+ * atomic adds. The saturated sum is stored in the device
+ * buffer. ALSA fills frames played with silence, and sum
+ * of frames played is cleared, by whoever gets there
+ * first, for the next lap.
+ *
+ * In capture, the owner wakes up once per period and
+ * publishes hw_ptr in the shared area. Each process
+ * reads the device buffer at its own position, with no
+ * system call, and detects itself when it was too slow
+ * and frames were overwritten.
+ *
+ * NOTE: The owner serves the socket from a thread. When
+ * it closes, no new process can attach. Processes
+ * attached keep working, but in capture hw_ptr isn't
+ * published anymore: each of them synchronizes it with
+ * a system call per read.
+ */
+
+#define _GNU_SOURCE /* memfd_create(), accept4() */
+
+#include <errno.h>       /* errno */
+#include <limits.h>      /* ULONG_MAX */
+#include <poll.h>        /* poll() */
+#include <pthread.h>     /* pthread_*() */
+#include <stddef.h>      /* offsetof() */
+#include <stdint.h>      /* int*_t, uint64_t */
+#include <stdio.h>       /* snprintf() */
+#include <string.h>      /* memset(), memcpy() */
+#include <sys/eventfd.h> /* eventfd() */
+#include <sys/ioctl.h>   /* ioctl() */
+#include <sys/mman.h>    /* mmap(), memfd_create() */
+#include <sys/socket.h>  /* socket(), sendmsg(), recvmsg() */
+#include <sys/stat.h>    /* fstat() */
+#include <sys/un.h>      /* struct sockaddr_un */
+#include <time.h>        /* nanosleep() */
+#include <unistd.h>      /* close(), ftruncate() */
+
+#include "sound_global.h"
+#include "sound_operations.h" /* snd_sync(), snd_stop(), ... */
+#include "sound_parameters.h" /* SND_FORMAT_* */
+#include "sound_setup.h"      /* snd_open(), snd_attach(), snd_detach() */
+#include "sound_share.h"
+
+/* times to retry while another process becomes owner */
+#define SHARE_ATTEMPTS  50
+#define SHARE_RETRY_NS  10000000 /* 10 milliseconds */
+
+#define SHARE_BACKLOG  8
+
+/*
+ * Pointers
+ * ========
+ */
+
+static inline unsigned long
+pointer_add(struct snd *snd, unsigned long ptr, unsigned long frames)
+{
+	ptr += frames;
+	if (ptr >= snd->boundary)
+		ptr -= snd->boundary;
+
+	return ptr;
+}
+
+static inline unsigned long
+pointer_sub(struct snd *snd, unsigned long ptr, unsigned long frames)
+{
+	if (ptr < frames)
+		ptr += snd->boundary;
+
+	return ptr - frames;
+}
+
+/* frames from 'from' up to 'to' */
+static inline unsigned long
+distance(struct snd *snd, unsigned long from, unsigned long to)
+{
+	return to >= from ? to - from : to + snd->boundary - from;
+}
+
+/* true if 'ptr' is before 'ref' (less than half boundary behind) */
+static inline int
+is_behind(struct snd *snd, unsigned long ptr, unsigned long ref)
+{
+	return ptr != ref && distance(snd, ref, ptr) > snd->boundary / 2;
+}
+
+/*
+ * frames kept between the hardware and a process, so a
+ * slightly late process doesn't touch frames being cleared
+ */
+static inline unsigned long
+guard(struct snd_share *share)
+{
+	return share->area->config.period_size / 2;
+}
+
+static inline unsigned long
+hw_ptr(struct snd *snd)
+{
+	return __atomic_load_n(&snd->status->hw_ptr, __ATOMIC_RELAXED);
+}
+
+/*
+ * Playback
+ * ========
+ */
+
+/* bytes of a sum slot, zero if format can't be mixed */
+static size_t
+sum_bytes(unsigned int format)
+{
+	switch (format) {
+	case SND_FORMAT_S16_LE:
+		return sizeof(int32_t);
+	case SND_FORMAT_S24_LE:
+	case SND_FORMAT_S32_LE:
+		return sizeof(int64_t);
+	}
+
+	return 0;
+}
+
+/*
+ * Add to the sum and store it saturated. Another process
+ * may add to the same sample in between, then the newer
+ * sum is stored again. Adding zero changes nothing.
+ */
+static void
+mix_16(int16_t *dst, int32_t *sum, const int16_t *src, unsigned int samples)
+{
+	int32_t value, stored;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		if (src[i] == 0)
+			continue;
+
+		value = __atomic_add_fetch(&sum[i], src[i], __ATOMIC_SEQ_CST);
+		do {
+			stored = value;
+			if (value > INT16_MAX)
+				value = INT16_MAX;
+			else if (value < INT16_MIN)
+				value = INT16_MIN;
+			__atomic_store_n(&dst[i], value, __ATOMIC_SEQ_CST);
+			value = __atomic_load_n(&sum[i], __ATOMIC_SEQ_CST);
+		} while (value != stored);
+	}
+}
+
+/* S24_LE and S32_LE, 'max' is the largest sample */
+static void
+mix_32(int32_t *dst, int64_t *sum, const int32_t *src, unsigned int samples,
+       int32_t max)
+{
+	int64_t value, stored;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		if (src[i] == 0)
+			continue;
+
+		value = __atomic_add_fetch(&sum[i], src[i], __ATOMIC_SEQ_CST);
+		do {
+			stored = value;
+			if (value > max)
+				value = max;
+			else if (value < -(int64_t) max - 1)
+				value = -(int64_t) max - 1;
+			__atomic_store_n(&dst[i], value, __ATOMIC_SEQ_CST);
+			value = __atomic_load_n(&sum[i], __ATOMIC_SEQ_CST);
+		} while (value != stored);
+	}
+}
+
+/* mix continuous frames at 'offset' of the ring */
+static void
+mix(struct snd_share *share, unsigned int offset, const void *src,
+    unsigned int frames)
+{
+	struct snd *snd = &share->snd;
+	unsigned int samples = frames * snd->channels;
+	char *dst = snd->mmap_buffer;
+	char *sum = share->area->sum;
+
+	dst += snd_frames_to_bytes(snd, offset);
+	sum += offset * snd->channels *
+	       sum_bytes(share->area->config.format);
+
+	switch (share->area->config.format) {
+	case SND_FORMAT_S16_LE:
+		mix_16((int16_t*) dst, (int32_t*) sum, src, samples);
+		break;
+	case SND_FORMAT_S24_LE:
+		mix_32((int32_t*) dst, (int64_t*) sum, src, samples, 0x7fffff);
+		break;
+	case SND_FORMAT_S32_LE:
+		mix_32((int32_t*) dst, (int64_t*) sum, src, samples,
+		       INT32_MAX);
+		break;
+	}
+}
+
+/* zero sum of continuous frames */
+static void
+clear(struct snd_share *share, unsigned int offset, unsigned int frames)
+{
+	size_t bytes = share->snd.channels *
+	               sum_bytes(share->area->config.format);
+
+	memset(share->area->sum + offset * bytes, 0, frames * bytes);
+}
+
+/*
+ * clear the sum of frames played, so the next lap of
+ * the ring starts from zero
+ *
+ * Only one process clears at a time: the one that moves
+ * clear_claim from clear_ptr. Others find a clear in
+ * progress and go on.
+ *
+ * Clearing takes far less than a period. A claim a
+ * period behind hardware is stale (its process was
+ * preempted, or died) and is taken over, from clear_ptr.
+ * clear_ptr only moves forward, but a process resuming
+ * a stale claim may clear frames just mixed for the next
+ * lap (a glitch, not a stall).
+ */
+static void
+clear_played(struct snd_share *share, unsigned long hw)
+{
+	struct snd_share_area *area = share->area;
+	struct snd *snd = &share->snd;
+	unsigned long ptr, claim, target, frames;
+	unsigned int offset, chunk;
+
+	ptr = __atomic_load_n(&area->clear_ptr, __ATOMIC_ACQUIRE);
+	target = pointer_sub(snd, hw, guard(share));
+	if (!is_behind(snd, ptr, target))
+		return;
+
+	claim = __atomic_load_n(&area->clear_claim, __ATOMIC_ACQUIRE);
+	if (claim != ptr && (!is_behind(snd, claim, target) ||
+	    distance(snd, claim, target) < area->config.period_size))
+		return;
+
+	if (!__atomic_compare_exchange_n(&area->clear_claim, &claim, target,
+	                                 0, __ATOMIC_ACQ_REL,
+	                                 __ATOMIC_RELAXED))
+		return;
+
+	/* the stale claim may have been published meanwhile */
+	ptr = __atomic_load_n(&area->clear_ptr, __ATOMIC_ACQUIRE);
+	if (!is_behind(snd, ptr, target))
+		return;
+
+	frames = distance(snd, ptr, target);
+	if (frames > snd->buffer_size)
+		frames = snd->buffer_size;
+
+	offset = ptr % snd->buffer_size;
+	while (frames) {
+		chunk = snd->buffer_size - offset;
+		if (chunk > frames)
+			chunk = frames;
+		clear(share, offset, chunk);
+		frames -= chunk;
+		offset = 0;
+	}
+
+	/* publish, unless a newer clear already has */
+	while (!__atomic_compare_exchange_n(&area->clear_ptr, &ptr, target, 0,
+	                                    __ATOMIC_RELEASE,
+	                                    __ATOMIC_ACQUIRE)) {
+		if (!is_behind(snd, ptr, target))
+			break;
+	}
+}
+
+/*
+ * frames that can be mixed at appl_ptr
+ *
+ * If the process is late (hardware has passed appl_ptr),
+ * appl_ptr is moved ahead of hardware and the frames
+ * skipped are accounted in underrun.
+ */
+static long
+playback_room(struct snd_share *share)
+{
+	struct snd *snd = &share->snd;
+	unsigned long hw, end, start;
+
+	if (snd_sync(snd, SND_SYNC_HW | SND_SYNC_GET) < 0)
+		return -1;
+
+	hw = hw_ptr(snd);
+	clear_played(share, hw);
+
+	start = pointer_add(snd, hw, guard(share));
+	if (is_behind(snd, share->appl_ptr, start)) {
+		share->underrun += distance(snd, share->appl_ptr, start);
+		share->appl_ptr = start;
+	}
+
+	end = pointer_add(snd, __atomic_load_n(&share->area->clear_ptr,
+	                                       __ATOMIC_ACQUIRE),
+	                  snd->buffer_size);
+	if (!is_behind(snd, share->appl_ptr, end))
+		return 0;
+
+	return distance(snd, share->appl_ptr, end);
+}
+
+/*
+ * mix frames into the shared device (playback)
+ *
+ * Never blocks. Return the number of frames mixed, which
+ * is less than 'frames' if there is no room, or -1 on
+ * error.
+ */
+ssize_t
+snd_share_write(struct snd_share *share, const void *data,
+                unsigned int frames)
+{
+	struct snd *snd = &share->snd;
+	const char *src = data;
+	unsigned int offset, chunk;
+	unsigned int done;
+	long room;
+
+	room = playback_room(share);
+	if (room == -1)
+		return -1;
+	if (frames > room)
+		frames = room;
+
+	for (done = 0; done < frames; done += chunk) {
+		offset = share->appl_ptr % snd->buffer_size;
+		chunk = snd->buffer_size - offset;
+		if (chunk > frames - done)
+			chunk = frames - done;
+
+		mix(share, offset, src + snd_frames_to_bytes(snd, done), chunk);
+		share->appl_ptr = pointer_add(snd, share->appl_ptr, chunk);
+	}
+
+	return frames;
+}
+
+/*
+ * Capture
+ * =======
+ */
+
+/*
+ * Published hw_ptr lags hardware up to a period, so
+ * frames older than this may be overwritten already.
+ */
+static inline unsigned long
+capture_limit(struct snd_share *share)
+{
+	return share->snd.buffer_size - share->area->config.period_size;
+}
+
+/* owner: publish hw_ptr and wake up again in a period */
+static int
+publish_hw_ptr(struct snd_share *share)
+{
+	struct snd *snd = &share->snd;
+	unsigned long hw;
+
+	if (snd_sync(snd, SND_SYNC_HW | SND_SYNC_GET) < 0)
+		return -1;
+
+	hw = hw_ptr(snd);
+	__atomic_store_n(&share->area->hw_ptr, hw, __ATOMIC_RELEASE);
+
+	/* device appl_ptr only drives wakeups (avail_min) */
+	snd->control->appl_ptr = hw;
+
+	return snd_sync(snd, SND_SYNC_SET);
+}
+
+/*
+ * hw_ptr as published by the owner or, once the owner
+ * has left, as synchronized by this process
+ */
+static int
+capture_hw_ptr(struct snd_share *share, unsigned long *hw)
+{
+	struct snd *snd = &share->snd;
+
+	if (__atomic_load_n(&share->area->publishing, __ATOMIC_ACQUIRE)) {
+		*hw = __atomic_load_n(&share->area->hw_ptr, __ATOMIC_ACQUIRE);
+		return 0;
+	}
+
+	if (snd_sync(snd, SND_SYNC_HW | SND_SYNC_GET) < 0)
+		return -1;
+
+	*hw = hw_ptr(snd);
+
+	return 0;
+}
+
+/*
+ * frames to be read at appl_ptr
+ *
+ * If frames at appl_ptr may have been overwritten, the
+ * frames are skipped up to hw_ptr, accounted in overrun,
+ * and -1 is returned with errno set to EPIPE.
+ */
+static long
+capture_avail(struct snd_share *share)
+{
+	struct snd *snd = &share->snd;
+	unsigned long hw, avail;
+
+	if (capture_hw_ptr(share, &hw) == -1)
+		return -1;
+	if (!is_behind(snd, share->appl_ptr, hw))
+		return 0;
+
+	avail = distance(snd, share->appl_ptr, hw);
+	if (avail > capture_limit(share)) {
+		share->overrun += avail;
+		share->appl_ptr = hw;
+		errno = EPIPE;
+		return -1;
+	}
+
+	return avail;
+}
+
+/*
+ * read frames from the shared device (capture)
+ *
+ * Never blocks. Return the number of frames read, which
+ * is less than 'frames' if there aren't enough. If the
+ * process was too slow and frames were lost, -1 is
+ * returned with errno set to EPIPE, and reading goes on
+ * from the newest frame.
+ */
+ssize_t
+snd_share_read(struct snd_share *share, void *data, unsigned int frames)
+{
+	struct snd *snd = &share->snd;
+	unsigned long start = share->appl_ptr;
+	unsigned int offset, chunk;
+	unsigned int done;
+	char *dst = data;
+	long avail;
+
+	avail = capture_avail(share);
+	if (avail == -1)
+		return -1;
+	if (frames > avail)
+		frames = avail;
+
+	for (done = 0; done < frames; done += chunk) {
+		offset = share->appl_ptr % snd->buffer_size;
+		chunk = snd->buffer_size - offset;
+		if (chunk > frames - done)
+			chunk = frames - done;
+
+		memcpy(dst + snd_frames_to_bytes(snd, done),
+		       (char*) snd->mmap_buffer +
+		       snd_frames_to_bytes(snd, offset),
+		       snd_frames_to_bytes(snd, chunk));
+		share->appl_ptr = pointer_add(snd, share->appl_ptr, chunk);
+	}
+
+	/* hardware may have overwritten them while copying */
+	share->appl_ptr = start;
+	if (capture_avail(share) == -1)
+		return -1;
+	share->appl_ptr = pointer_add(snd, start, frames);
+
+	return frames;
+}
+
+/*
+ * sleep until 'frames' frames can be written (playback)
+ * or read (capture)
+ *
+ * There is no wakeup from the device for a process (it
+ * runs freely), so sleep time is estimated from the
+ * rate. 'frames' is limited to what can be ever ready.
+ *
+ * In capture, -1 with errno set to EPIPE means frames
+ * were lost, as in snd_share_read().
+ */
+int
+snd_share_wait(struct snd_share *share, unsigned int frames)
+{
+	struct snd *snd = &share->snd;
+	unsigned long maximum;
+	struct timespec ts;
+	unsigned long missing;
+	long ready;
+
+	if (snd->type == SND_INPUT)
+		maximum = capture_limit(share);
+	else
+		maximum = snd->buffer_size - 2 * guard(share);
+	if (frames > maximum)
+		frames = maximum;
+
+	while (1) {
+		if (snd->type == SND_INPUT)
+			ready = capture_avail(share);
+		else
+			ready = playback_room(share);
+		if (ready == -1)
+			return -1;
+		if (ready >= frames)
+			return 0;
+
+		missing = frames - ready;
+		ts.tv_sec = missing / snd->rate;
+		ts.tv_nsec = (missing % snd->rate) * 1000000000ULL / snd->rate;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Passing file descriptors
+ * ========================
+ */
+
+static socklen_t
+share_address(struct sockaddr_un *addr, const struct snd_config *config)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	/* abstract namespace: the name starts with a null byte */
+	snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+	         "simplesound-pcmC%uD%u%c", config->card, config->device,
+	         config->flags & SND_INPUT ? 'c' : 'p');
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 +
+	       strlen(addr->sun_path + 1);
+}
+
+static int
+send_fds(int sock, int *fds, unsigned int count)
+{
+	char control[CMSG_SPACE(sizeof(int) * count)];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char byte = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1)
+		return -1;
+
+	return 0;
+}
+
+static int
+receive_fds(int sock, int *fds, unsigned int count)
+{
+	char control[CMSG_SPACE(sizeof(int) * count)];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t ret;
+	char byte;
+
+	memset(&msg, 0, sizeof(msg));
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (ret != 1) {
+		/* owner has gone before handing them */
+		if (ret == 0)
+			errno = ECONNRESET;
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+
+	return 0;
+}
+
+/*
+ * owner's thread: hand out file descriptors and, in
+ * capture, publish hw_ptr once per period
+ */
+static void *
+owner_thread(void *arg)
+{
+	struct snd_share *share = arg;
+	int fds[2] = {share->snd.fd, share->area_fd};
+	struct pollfd pfd[3];
+	nfds_t count = 2;
+	int sock;
+
+	pfd[0].fd = share->listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = share->stop_fd;
+	pfd[1].events = POLLIN;
+
+	if (share->snd.type == SND_INPUT) {
+		pfd[2].fd = share->snd.fd;
+		pfd[2].events = POLLIN;
+		count = 3;
+	}
+
+	while (1) {
+		if (poll(pfd, count, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		if (count == 3 && pfd[2].revents &&
+		    publish_hw_ptr(share) == -1)
+			break;
+
+		if (!pfd[0].revents)
+			continue;
+
+		sock = accept4(share->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (sock == -1)
+			continue;
+
+		/* counted before, so the device isn't stopped meanwhile */
+		__atomic_add_fetch(&share->area->users, 1, __ATOMIC_ACQ_REL);
+		if (send_fds(sock, fds, 2) == -1)
+			__atomic_sub_fetch(&share->area->users, 1,
+			                   __ATOMIC_ACQ_REL);
+
+		close(sock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Setup
+ * =====
+ */
+
+static int
+map_area(struct snd_share *share, int fd)
+{
+	share->area = mmap(NULL, share->area_size, PROT_READ | PROT_WRITE,
+	                   MAP_SHARED, fd, 0);
+	if (share->area == MAP_FAILED)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * start the device with its buffer full of silence
+ *
+ * appl_ptr of the device is not moved anymore. As
+ * stop_threshold is boundary, the device never stops,
+ * and ALSA fills with silence what it has played.
+ */
+static int
+start_device(struct snd *snd)
+{
+	if (ioctl(snd->fd, SNDRV_PCM_IOCTL_PREPARE) == -1 ||
+	    snd_sync(snd, SND_SYNC_GET) < 0)
+		return -1;
+
+	if (snd->type == SND_OUTPUT &&
+	    snd_write_silence(snd, snd->buffer_size) == -1)
+		return -1;
+
+	if (ioctl(snd->fd, SNDRV_PCM_IOCTL_START) == -1)
+		return -1;
+
+	return 0;
+}
+
+/* become owner: open device, create area and serve 'sock' */
+static int
+create(struct snd_share *share, int sock, struct snd_config *config)
+{
+	struct snd *snd = &share->snd;
+	struct snd_config cfg = *config;
+	size_t bytes;
+
+	if (listen(sock, SHARE_BACKLOG) == -1)
+		goto _go_close_sock;
+
+	bytes = sum_bytes(config->format);
+	if (config->flags & SND_OUTPUT && bytes == 0) {
+		errno = EINVAL;
+		goto _go_close_sock;
+	}
+
+	cfg.flags |= SND_MMAP;
+	cfg.flags &= ~SND_RECOVER;
+	cfg.stop_threshold = 0; /* boundary, runs freely */
+	cfg.silence_threshold = 0;
+	if (cfg.flags & SND_INPUT)
+		cfg.silence_size = 0;
+	else
+		cfg.silence_size = ULONG_MAX;
+	if (cfg.period_count == 0)
+		cfg.period_count = 4;
+
+	if (snd_open(snd, &cfg) == -1)
+		goto _go_close_sock;
+
+	share->area_size = sizeof(*share->area);
+	if (snd->type == SND_OUTPUT)
+		share->area_size += snd->buffer_size * snd->channels * bytes;
+
+	share->area_fd = memfd_create("simplesound-share", MFD_CLOEXEC);
+	if (share->area_fd == -1)
+		goto _go_close_snd;
+
+	/* memfd is zeroed: clear pointers and sum start at zero */
+	if (ftruncate(share->area_fd, share->area_size) == -1 ||
+	    map_area(share, share->area_fd) == -1)
+		goto _go_close_area;
+
+	share->area->config = cfg;
+	share->area->boundary = snd->boundary;
+	share->area->users = 1;
+	share->area->publishing = snd->type == SND_INPUT;
+
+	if (start_device(snd) == -1)
+		goto _go_unmap_area;
+
+	share->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (share->stop_fd == -1)
+		goto _go_stop;
+
+	share->listen_fd = sock;
+	if (pthread_create(&share->thread, NULL, owner_thread, share) != 0)
+		goto _go_close_stop;
+
+	return 0;
+
+_go_close_stop:
+	close(share->stop_fd);
+_go_stop:
+	snd_stop(snd);
+_go_unmap_area:
+	munmap(share->area, share->area_size);
+_go_close_area:
+	close(share->area_fd);
+_go_close_snd:
+	snd_close(snd);
+_go_close_sock:
+	close(sock);
+	return -1;
+}
+
+/* attach to the device of the owner connected by 'sock' */
+static int
+attach(struct snd_share *share, int sock, struct snd_config *config)
+{
+	struct snd_config *cfg;
+	struct stat st;
+	int fds[2];
+
+	if (receive_fds(sock, fds, 2) == -1)
+		return -1;
+
+	if (fstat(fds[1], &st) == -1)
+		goto _go_close_fds;
+
+	share->area_size = st.st_size;
+	if (map_area(share, fds[1]) == -1)
+		goto _go_close_fds;
+	close(fds[1]);
+
+	cfg = &share->area->config;
+	if (cfg->format != config->format ||
+	    cfg->channels != config->channels || cfg->rate != config->rate) {
+		errno = EINVAL;
+		goto _go_unmap_area;
+	}
+
+	if (snd_attach(&share->snd, fds[0], cfg, share->area->boundary) == -1)
+		goto _go_unmap_area;
+
+	share->listen_fd = -1;
+	share->area_fd = -1;
+
+	return 0;
+
+_go_unmap_area:
+	__atomic_sub_fetch(&share->area->users, 1, __ATOMIC_ACQ_REL);
+	munmap(share->area, share->area_size);
+	close(fds[0]);
+	return -1;
+
+_go_close_fds:
+	close(fds[0]);
+	close(fds[1]);
+	return -1;
+}
+
+/*
+ * open a sound device shared with other processes
+ *
+ * 'config' is as for snd_open(). SND_MMAP is implied and
+ * access must be interleaved. Playback supports S16_LE,
+ * S24_LE and S32_LE, capture any format.
+ *
+ * If another process has the device, format, channels
+ * and rate must be the same, the remaining parameters
+ * are the ones of that process.
+ */
+int
+snd_share_open(struct snd_share *share, struct snd_config *config)
+{
+	struct sockaddr_un addr;
+	struct timespec retry = {0, SHARE_RETRY_NS};
+	socklen_t len;
+	unsigned int i;
+	int ret = -1;
+	int sock;
+
+	if (config->flags & SND_NONINTERLEAVED) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(share, 0, sizeof(*share));
+	len = share_address(&addr, config);
+
+	for (i = 0; i < SHARE_ATTEMPTS; i++) {
+		sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (sock == -1)
+			return -1;
+
+		if (connect(sock, (struct sockaddr*) &addr, len) == 0) {
+			ret = attach(share, sock, config);
+			close(sock);
+			if (ret == 0 || errno != ECONNRESET)
+				break;
+		} else if (bind(sock, (struct sockaddr*) &addr, len) == 0) {
+			/* create() owns sock now */
+			ret = create(share, sock, config);
+			break;
+		} else {
+			close(sock);
+			if (errno != EADDRINUSE)
+				return -1;
+		}
+
+		/* another process is becoming owner, or has just left */
+		nanosleep(&retry, NULL);
+		ret = -1;
+	}
+
+	if (ret == -1)
+		return -1;
+
+	/* capture from the newest frame, playback a bit ahead */
+	if (share->snd.type == SND_INPUT) {
+		if (capture_hw_ptr(share, &share->appl_ptr) == -1) {
+			snd_share_close(share);
+			return -1;
+		}
+	} else
+		share->appl_ptr = pointer_add(&share->snd,
+		                              hw_ptr(&share->snd),
+		                              guard(share));
+
+	return 0;
+}
+
+/*
+ * detach from a shared sound device
+ *
+ * The last process to close stops the device.
+ */
+void
+snd_share_close(struct snd_share *share)
+{
+	uint64_t one = 1;
+
+	if (share->listen_fd != -1) {
+		/* from now on, capture processes sync hw_ptr themselves */
+		__atomic_store_n(&share->area->publishing, 0, __ATOMIC_RELEASE);
+
+		/* thread waits in poll(), a cancellation point */
+		if (write(share->stop_fd, &one, sizeof(one)) != sizeof(one))
+			pthread_cancel(share->thread);
+		pthread_join(share->thread, NULL);
+		close(share->stop_fd);
+		close(share->listen_fd);
+		close(share->area_fd);
+	}
+
+	if (__atomic_sub_fetch(&share->area->users, 1, __ATOMIC_ACQ_REL) == 0)
+		snd_stop(&share->snd);
+
+	munmap(share->area, share->area_size);
+	snd_detach(&share->snd);
+}
@@ -0,0 +1,121 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOUND_SHARE_H
+#define SOUND_SHARE_H
+
+#include <pthread.h>   /* pthread_t */
+#include <stddef.h>    /* size_t */
+#include <sys/types.h> /* ssize_t */
+
+#include "sound_global.h"
+
+/*
+ * Memory shared by all processes of a sound device
+ * ================================================
+ *
+ * Created by the owner (the process that opened the
+ * device) and passed, with the device file descriptor,
+ * to the processes that attach.
+ */
+
+struct snd_share_area {
+	/* parameters of the owner's snd_open() */
+	struct snd_config config;
+	unsigned long boundary;
+
+	/* processes attached, the last one stops the device */
+	int users;
+
+	/*
+	 * Playback. Sum slots of frames from clear_ptr up to
+	 * clear_ptr + buffer_size are clear (or being summed)
+	 * in this lap of the ring. A process claims clearing
+	 * the frames played by moving clear_claim, and then
+	 * publishes them by moving clear_ptr. A claim left
+	 * behind by a process that stopped is taken over.
+	 */
+	unsigned long clear_ptr __attribute__((aligned(SND_CACHE_LINE)));
+	unsigned long clear_claim;
+
+	/*
+	 * Capture. hw_ptr of the device, published by the
+	 * owner once per period while publishing is set.
+	 */
+	unsigned long hw_ptr __attribute__((aligned(SND_CACHE_LINE)));
+	int publishing;
+
+	/* playback: sum of all processes, one per sample of ring */
+	char sum[] __attribute__((aligned(SND_CACHE_LINE)));
+};
+
+/*
+ * snd share
+ * =========
+ *
+ * A sound device shared by cooperating processes, in the
+ * manner of alsa-lib's dmix and dsnoop plugins. There is
+ * no server: each process mixes its frames straight into
+ * the mmaped device buffer (playback) or copies them from
+ * there (capture).
+ */
+
+struct snd_share {
+	/* attached device, do not use snd_close() on it */
+	struct snd snd;
+
+	struct snd_share_area *area;
+	size_t area_size;
+
+	/*
+	 * Owner only. The socket where other processes get
+	 * the file descriptors, and the thread serving it.
+	 * listen_fd is -1 in other processes.
+	 */
+	int listen_fd;
+	int area_fd;
+	int stop_fd;
+	pthread_t thread;
+
+	/* next frame to be mixed (playback) or read (capture) */
+	unsigned long appl_ptr;
+
+	/* frames skipped because snd_share_write() was late */
+	unsigned long underrun;
+
+	/* frames lost because snd_share_read() was late */
+	unsigned long overrun;
+};
+
+int
+snd_share_open(struct snd_share *share, struct snd_config *config);
+
+void
+snd_share_close(struct snd_share *share);
+
+ssize_t
+snd_share_write(struct snd_share *share, const void *data,
+                unsigned int frames);
+
+ssize_t
+snd_share_read(struct snd_share *share, void *data, unsigned int frames);
+
+int
+snd_share_wait(struct snd_share *share, unsigned int frames);
+
+#endif /* SOUND_SHARE_H */
@@ -0,0 +1,509 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decouple application from the sound device wakeups
+ *
+ * Application pushes (playback) or pulls (capture) frames
+ * at its own pace. A library thread wakes up with the
+ * sound device and moves frames between the ring and the
+ * sound device buffer.
+ *
+ * Ring operations are wait-free: a side loads the other
+ * side's pointer (acquire), copies, and stores its own
+ * pointer (release). Audio thread never takes a lock nor
+ * waits for the application. If application is late,
+ * silence is played (playback) or frames are dropped
+ * (capture), and it's accounted.
+ *
+ * Application is woken up through an eventfd only when
+ * room (playback) or frames (capture) cross watermark.
+ */
+
+#include <errno.h>       /* errno */
+#include <poll.h>        /* poll() */
+#include <pthread.h>     /* pthread_*() */
+#include <stdint.h>      /* uint64_t */
+#include <stdlib.h>      /* malloc(), free() */
+#include <string.h>      /* memcpy() */
+#include <sys/eventfd.h> /* eventfd() */
+#include <unistd.h>      /* read(), write(), close() */
+
+#include "sound_global.h"
+#include "sound_avail.h"      /* snd_avail() */
+#include "sound_operations.h" /* snd_sync(), snd_prepare(), ... */
+#include "sound_stream.h"
+#include "sound_transfer.h"   /* snd_writev(), snd_readv() */
+
+/* frames in ring, seen from each side */
+static inline unsigned int
+ring_filled(unsigned long write_ptr, unsigned long read_ptr)
+{
+	return write_ptr - read_ptr;
+}
+
+/*
+ * get the (up to two) continuous regions of 'frames'
+ * frames starting at 'ptr'
+ */
+static unsigned int
+ring_regions(struct snd_stream *s, unsigned long ptr, unsigned int frames,
+             struct snd_buffer *regions)
+{
+	unsigned int offset = ptr % s->size;
+	unsigned int continuous = s->size - offset;
+
+	regions[0].data = s->buffer + snd_frames_to_bytes(s->snd, offset);
+	if (frames <= continuous) {
+		regions[0].frames = frames;
+		return 1;
+	}
+
+	regions[0].frames = continuous;
+	regions[1].data = s->buffer;
+	regions[1].frames = frames - continuous;
+
+	return 2;
+}
+
+/* copy between user memory and ring regions */
+static void
+ring_copy(struct snd_stream *s, struct snd_buffer *regions,
+          unsigned int count, char *data, int to_ring)
+{
+	unsigned int bytes;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		bytes = snd_frames_to_bytes(s->snd, regions[i].frames);
+		if (to_ring)
+			memcpy(regions[i].data, data, bytes);
+		else
+			memcpy(data, regions[i].data, bytes);
+		data += bytes;
+	}
+}
+
+/*
+ * wake up application
+ *
+ * It fails only if the eventfd counter is full, and then
+ * s->fd is readable already.
+ */
+static int
+notify(struct snd_stream *s)
+{
+	uint64_t one = 1;
+
+	return write(s->fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+/*
+ * Audio thread
+ * ============
+ */
+
+/* ring -> sound device */
+static int
+drain(struct snd_stream *s, unsigned long avail)
+{
+	struct snd_buffer regions[2];
+	unsigned long read_ptr = s->read_ptr;
+	unsigned int filled;
+	unsigned int frames;
+	unsigned int count;
+	ssize_t tmp;
+
+	filled = ring_filled(__atomic_load_n(&s->write_ptr, __ATOMIC_ACQUIRE),
+	                     read_ptr);
+
+	frames = filled < avail ? filled : avail;
+	if (frames) {
+		count = ring_regions(s, read_ptr, frames, regions);
+		tmp = snd_writev(s->snd, regions, count);
+		if (tmp < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		__atomic_store_n(&s->read_ptr, read_ptr + tmp,
+		                 __ATOMIC_RELEASE);
+
+		/* room has just crossed watermark */
+		if (s->size - filled < s->watermark &&
+		    s->size - filled + tmp >= s->watermark)
+			notify(s);
+
+		avail -= tmp;
+	}
+
+	/*
+	 * Application is late. Play silence, but only until
+	 * the sound device stops waking us up, so audio
+	 * from application is played as soon as possible.
+	 */
+	if (avail >= s->snd->control->avail_min) {
+		frames = avail - s->snd->control->avail_min + 1;
+		if (snd_write_silence(s->snd, frames) == -1)
+			return -1;
+		s->underfed += frames;
+	}
+
+	return 0;
+}
+
+/* sound device -> ring */
+static int
+fill(struct snd_stream *s, unsigned long avail)
+{
+	struct snd_buffer regions[2];
+	unsigned long write_ptr = s->write_ptr;
+	unsigned int filled;
+	unsigned int frames;
+	unsigned int count;
+	ssize_t tmp;
+
+	filled = ring_filled(write_ptr, __atomic_load_n(&s->read_ptr,
+	                                                __ATOMIC_ACQUIRE));
+
+	frames = s->size - filled;
+	if (frames > avail)
+		frames = avail;
+
+	if (frames) {
+		count = ring_regions(s, write_ptr, frames, regions);
+		tmp = snd_readv(s->snd, regions, count);
+		if (tmp < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		__atomic_store_n(&s->write_ptr, write_ptr + tmp,
+		                 __ATOMIC_RELEASE);
+
+		/* frames have just crossed watermark */
+		if (filled < s->watermark && filled + tmp >= s->watermark)
+			notify(s);
+
+		avail -= tmp;
+	}
+
+	/* application is late, drop what doesn't fit */
+	if (avail) {
+		if (snd_forward(s->snd, avail) < 0)
+			return -1;
+		s->overflow += avail;
+	}
+
+	return 0;
+}
+
+/*
+ * prepare and start the sound device
+ *
+ * In playback, silence is written in between (see
+ * snd_prefill()), as writing into the mmaped buffer
+ * doesn't start the device.
+ */
+static int
+start_device(struct snd *snd)
+{
+	if (snd_prepare(snd) == -1)
+		return -1;
+
+	if (snd->type == SND_OUTPUT && snd_prefill(snd) == -1)
+		return -1;
+
+	/* a RW transfer may have started the device already */
+	if (snd_sync(snd, SND_SYNC_GET) < 0)
+		return -1;
+	if (snd->status->state == SND_STATE_PREPARED &&
+	    snd_trigger(snd) == -1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * POLLERR: restart the device if it's in xrun, otherwise
+ * it can't be recovered (e.g. disconnected) and polling
+ * it again would spin
+ */
+static int
+handle_error(struct snd *snd)
+{
+	switch (snd_xrun_account(snd)) {
+	case -1:
+		return -1;
+	case 1:
+		return start_device(snd);
+	}
+
+	return 0;
+}
+
+static int
+audio_loop(struct snd_stream *s)
+{
+	struct snd *snd = s->snd;
+	struct pollfd pfd[2];
+
+	pfd[0].fd = snd->fd;
+	pfd[0].events = snd->type & SND_INPUT ? POLLIN : POLLOUT;
+	pfd[1].fd = s->stop_fd;
+	pfd[1].events = POLLIN;
+
+	while (1) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (pfd[1].revents)
+			return 0;
+
+		if (pfd[0].revents & POLLERR && handle_error(snd) == -1)
+			return -1;
+
+		/* no ioctl() if status and control are mmaped */
+		if (snd_sync(snd, SND_SYNC_GET) < 0)
+			return -1;
+
+		if (snd->type & SND_INPUT) {
+			if (fill(s, snd_avail(snd)) == -1)
+				return -1;
+		} else {
+			if (drain(s, snd_avail(snd)) == -1)
+				return -1;
+		}
+	}
+}
+
+/*
+ * On failure, the error is kept in s->error and the
+ * application is woken up, so snd_stream_wait() returns.
+ */
+static void *
+audio_thread(void *arg)
+{
+	struct snd_stream *s = arg;
+
+	if (audio_loop(s) == -1) {
+		__atomic_store_n(&s->error, errno ? errno : EIO,
+		                 __ATOMIC_RELEASE);
+		notify(s);
+	}
+
+	return NULL;
+}
+
+/*
+ * Application side
+ * ================
+ */
+
+/*
+ * push frames into ring (playback)
+ *
+ * Never blocks. Return the number of frames pushed,
+ * which is less than 'frames' if ring is full.
+ */
+unsigned int
+snd_stream_write(struct snd_stream *s, const void *data, unsigned int frames)
+{
+	struct snd_buffer regions[2];
+	unsigned long write_ptr = s->write_ptr;
+	unsigned int room;
+	unsigned int count;
+
+	room = s->size - ring_filled(write_ptr,
+	                             __atomic_load_n(&s->read_ptr,
+	                                             __ATOMIC_ACQUIRE));
+	if (frames > room)
+		frames = room;
+	if (frames == 0)
+		return 0;
+
+	count = ring_regions(s, write_ptr, frames, regions);
+	ring_copy(s, regions, count, (char*) data, 1);
+
+	__atomic_store_n(&s->write_ptr, write_ptr + frames, __ATOMIC_RELEASE);
+
+	return frames;
+}
+
+/*
+ * pull frames from ring (capture)
+ *
+ * Never blocks. Return the number of frames pulled,
+ * which is less than 'frames' if ring is empty.
+ */
+unsigned int
+snd_stream_read(struct snd_stream *s, void *data, unsigned int frames)
+{
+	struct snd_buffer regions[2];
+	unsigned long read_ptr = s->read_ptr;
+	unsigned int filled;
+	unsigned int count;
+
+	filled = ring_filled(__atomic_load_n(&s->write_ptr, __ATOMIC_ACQUIRE),
+	                     read_ptr);
+	if (frames > filled)
+		frames = filled;
+	if (frames == 0)
+		return 0;
+
+	count = ring_regions(s, read_ptr, frames, regions);
+	ring_copy(s, regions, count, data, 0);
+
+	__atomic_store_n(&s->read_ptr, read_ptr + frames, __ATOMIC_RELEASE);
+
+	return frames;
+}
+
+/* room (playback) or frames (capture) for application */
+static unsigned int
+ready(struct snd_stream *s)
+{
+	unsigned int filled;
+
+	filled = ring_filled(__atomic_load_n(&s->write_ptr, __ATOMIC_ACQUIRE),
+	                     __atomic_load_n(&s->read_ptr, __ATOMIC_ACQUIRE));
+
+	return s->snd->type & SND_INPUT ? filled : s->size - filled;
+}
+
+/*
+ * wait up to 'timeout' milliseconds (-1 is forever)
+ * until room (playback) or frames (capture) reach
+ * watermark
+ *
+ * Instead of this, application may poll s->fd and call
+ * it with zero timeout after wake up.
+ *
+ * Return 1 if watermark was reached, 0 on timeout. If
+ * audio thread has failed, return -1 with errno set to
+ * its error (see s->error).
+ */
+int
+snd_stream_wait(struct snd_stream *s, int timeout)
+{
+	struct pollfd pfd = {s->fd, POLLIN, 0};
+	uint64_t value;
+	int error;
+
+	while (ready(s) < s->watermark) {
+		error = __atomic_load_n(&s->error, __ATOMIC_ACQUIRE);
+		if (error) {
+			errno = error;
+			return -1;
+		}
+
+		/* audio thread notifies when watermark is crossed */
+		if (poll(&pfd, 1, timeout) == -1)
+			return -1;
+		if (pfd.revents == 0)
+			return 0;
+		if (read(s->fd, &value, sizeof(value)) == -1 &&
+		    errno != EAGAIN)
+			return -1;
+	}
+
+	return 1;
+}
+
+/*
+ * Setup
+ * =====
+ */
+
+/*
+ * create a stream of 'size' frames on an opened sound
+ * device (interleaved access only)
+ */
+int
+snd_stream_open(struct snd_stream *s, struct snd *snd, unsigned int size,
+                unsigned int watermark)
+{
+	if (snd->flags & SND_NONINTERLEAVED || size == 0)
+		return -1;
+
+	s->snd = snd;
+	s->size = size;
+	s->watermark = watermark > size ? size : watermark;
+	s->write_ptr = 0;
+	s->read_ptr = 0;
+	s->underfed = 0;
+	s->overflow = 0;
+	s->error = 0;
+
+	s->buffer = malloc(snd_frames_to_bytes(snd, size));
+	if (!s->buffer)
+		return -1;
+
+	s->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (s->fd == -1)
+		goto _go_free;
+
+	s->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (s->stop_fd == -1)
+		goto _go_close_fd;
+
+	return 0;
+
+_go_close_fd:
+	close(s->fd);
+_go_free:
+	free(s->buffer);
+	return -1;
+}
+
+void
+snd_stream_close(struct snd_stream *s)
+{
+	close(s->stop_fd);
+	close(s->fd);
+	free(s->buffer);
+}
+
+/* start sound device and audio thread */
+int
+snd_stream_start(struct snd_stream *s)
+{
+	s->error = 0;
+
+	if (start_device(s->snd) == -1)
+		return -1;
+
+	if (pthread_create(&s->thread, NULL, audio_thread, s) != 0) {
+		snd_stop(s->snd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* stop audio thread and sound device */
+int
+snd_stream_stop(struct snd_stream *s)
+{
+	uint64_t one = 1;
+
+	if (write(s->stop_fd, &one, sizeof(one)) != sizeof(one))
+		return -1;
+	pthread_join(s->thread, NULL);
+
+	return snd_stop(s->snd);
+}
@@ -0,0 +1,100 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2017, 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOUND_STREAM_H
+#define SOUND_STREAM_H
+
+#include <pthread.h> /* pthread_t */
+
+#include "sound_global.h"
+
+/*
+ * snd stream
+ * ==========
+ *
+ * A ring of frames between the application and an audio
+ * thread owned by the library. In playback, application
+ * writes into the ring and audio thread drains it into
+ * sound device. In capture, the other way around.
+ *
+ * There is one producer and one consumer. Each pointer
+ * is written by one side only and lives in its own
+ * cache line.
+ */
+
+struct snd_stream {
+	struct snd *snd;
+
+	/* ring of frames */
+	char *buffer;
+	unsigned int size; /* frames */
+
+	/*
+	 * eventfd, readable when room (playback) or frames
+	 * (capture) for application reach watermark
+	 */
+	int fd;
+	unsigned int watermark;
+
+	/* eventfd to stop audio thread */
+	int stop_fd;
+
+	pthread_t thread;
+
+	/*
+	 * Audio thread accounting. Frames of silence played
+	 * because ring was empty (playback), or frames lost
+	 * because ring was full (capture).
+	 */
+	unsigned long underfed;
+	unsigned long overflow;
+
+	/*
+	 * errno of the failure that ended the audio thread,
+	 * or zero
+	 */
+	int error;
+
+	/* frames written into and read from ring */
+	unsigned long write_ptr __attribute__((aligned(SND_CACHE_LINE)));
+	unsigned long read_ptr __attribute__((aligned(SND_CACHE_LINE)));
+};
+
+int
+snd_stream_open(struct snd_stream *s, struct snd *snd, unsigned int size,
+                unsigned int watermark);
+
+void
+snd_stream_close(struct snd_stream *s);
+
+int
+snd_stream_start(struct snd_stream *s);
+
+int
+snd_stream_stop(struct snd_stream *s);
+
+unsigned int
+snd_stream_write(struct snd_stream *s, const void *data, unsigned int frames);
+
+unsigned int
+snd_stream_read(struct snd_stream *s, void *data, unsigned int frames);
+
+int
+snd_stream_wait(struct snd_stream *s, int timeout);
+
+#endif /* SOUND_STREAM_H */
@@ -27,7 +27,8 @@
 #endif
 //#include <time.h>
 
-#include <errno.h>     /* EPIPE */
+#include <errno.h>     /* EPIPE, EAGAIN, EINVAL */
+#include <poll.h>      /* poll() */
 #include <string.h>    /* memcpy() */
 #include <sys/ioctl.h> /* ioctl() */
 
@@ -35,53 +36,219 @@
 #include <sound/asound.h>
 
 #include "sound_global.h"     /* struct snd */
+#include "sound_avail.h"      /* snd_avail() */
 #include "sound_operations.h" /* snd_sync() */
+#include "sound_transfer.h"
 
 /*
  * MMAP access
  * ===========
  */
 
-/* copy data from/to mmap buffer */
+/*
+ * copy data from/to each channel area of mmap buffer
+ *
+ * buf is an array of buffers, one per channel.
+ */
+static void
+mmap_areas_copy_n(struct snd *snd, unsigned int pcm_offset, void **buf,
+                  unsigned int user_offset, unsigned int frames)
+{
+	int size_bytes        = frames * snd->bytes_per_sample;
+	int pcm_offset_bytes  = pcm_offset * snd->bytes_per_sample;
+	int user_offset_bytes = user_offset * snd->bytes_per_sample;
+	unsigned int i;
+
+	for (i = 0; i < snd->channels; i++) {
+		if (snd->type & SND_INPUT)
+			memcpy((char*) buf[i] + user_offset_bytes,
+			       (char*) snd->mmap_areas[i] + pcm_offset_bytes,
+			       size_bytes);
+		else
+			memcpy((char*) snd->mmap_areas[i] + pcm_offset_bytes,
+			       (char*) buf[i] + user_offset_bytes,
+			       size_bytes);
+	}
+}
+
+/*
+ * copy data from/to mmap buffer
+ *
+ * In non-interleaved access, buf is an array of buffers,
+ * one per channel.
+ */
 int
-snd_mmap_areas_copy(struct snd *snd, unsigned int pcm_offset, char *buf,
+snd_mmap_areas_copy(struct snd *snd, unsigned int pcm_offset, void *buf,
                       unsigned int user_offset, unsigned int frames)
 {
 	int size_bytes        = snd_frames_to_bytes(snd, frames);
 	int pcm_offset_bytes  = snd_frames_to_bytes(snd, pcm_offset);
 	int user_offset_bytes = snd_frames_to_bytes(snd, user_offset);
 
+	if (snd->mmap_areas) {
+		mmap_areas_copy_n(snd, pcm_offset, buf, user_offset, frames);
+		return 0;
+	}
+
 	if (snd->type & SND_INPUT)
-		memcpy(buf + user_offset_bytes,
+		memcpy((char*)buf + user_offset_bytes,
 		       (char*)snd->mmap_buffer + pcm_offset_bytes, size_bytes);
 	else
 		memcpy((char*)snd->mmap_buffer + pcm_offset_bytes,
-		       buf + user_offset_bytes, size_bytes);
+		       (char*)buf + user_offset_bytes, size_bytes);
 
 	return 0;
 }
 
-/* update application pointer */
+/* add frames to a hardware or application pointer */
+static inline unsigned long
+pointer_add(struct snd *snd, unsigned long ptr, unsigned int frames)
+{
+	ptr += frames;
+	/* check for boundary wrap */
+	if (ptr >= snd->boundary)
+		ptr -= snd->boundary;
+
+	return ptr;
+}
+
+/* update application pointer, unchanged if ALSA fails */
 int
 snd_update_appl_ptr(struct snd *snd, unsigned int frames)
 {
 	unsigned long appl_ptr = snd->control->appl_ptr;
 
-	appl_ptr += frames;
-	/* check for boundary wrap */
-	if (appl_ptr > snd->boundary)
-		appl_ptr -= snd->boundary;
+	snd->control->appl_ptr = pointer_add(snd, appl_ptr, frames);
 
-	snd->control->appl_ptr = appl_ptr;
-
-	if (snd_sync(snd, SND_SYNC_SET) < 0)
+	if (snd_sync(snd, SND_SYNC_SET) < 0) {
+		snd->control->appl_ptr = appl_ptr;
 		return -1;
+	}
 
 	return frames;
 }
 
-ssize_t
-snd_mmap_transfer(struct snd *snd, void *buffer, unsigned int frames)
+/*
+ * limit frames to the continuous and available ones at
+ * appl_ptr, and return the offset of appl_ptr in buffer
+ *
+ * If status isn't mmaped, hw_ptr is synchronized first
+ * (see mmap_wait_avail()).
+ */
+static long
+mmap_region(struct snd *snd, unsigned int *frames)
+{
+	/* offset in sound device buffer */
+	unsigned int snd_offset;
+	/* maximum continuous memory from snd_offset */
+	unsigned int continuous;
+	unsigned long avail;
+
+	if (snd->sync_ptr != NULL && snd_sync(snd, SND_SYNC_HW) < 0)
+		return -1;
+
+	snd_offset = snd->control->appl_ptr % snd->buffer_size;
+
+	continuous = snd->buffer_size - snd_offset;
+	if (*frames > continuous)
+		*frames = continuous;
+
+	avail = snd_avail(snd);
+	if (*frames > avail)
+		*frames = avail;
+
+	return snd_offset;
+}
+
+/*
+ * get the continuous region of the ring buffer at appl_ptr
+ *
+ * On entry, *frames is the number of frames the caller
+ * wants to transfer. On return, it's set to the number
+ * of continuous and available frames that can be written
+ * (playback) or read (capture) directly in the returned
+ * address. It may be zero.
+ *
+ * No data is copied. After rendering or consuming the
+ * region, the caller must call snd_mmap_commit() with
+ * the number of frames actually transferred.
+ *
+ * Without SND_MMAP, and in non-interleaved access where
+ * there is no single region (use snd_mmap_begin_n()),
+ * NULL is returned and errno is set to EINVAL. NULL is
+ * also returned if hw_ptr can't be synchronized.
+ */
+void *
+snd_mmap_begin(struct snd *snd, unsigned int *frames)
+{
+	long snd_offset;
+
+	if (snd->mmap_buffer == NULL || snd->mmap_areas) {
+		*frames = 0;
+		errno = EINVAL;
+		return NULL;
+	}
+
+	snd_offset = mmap_region(snd, frames);
+	if (snd_offset == -1) {
+		*frames = 0;
+		return NULL;
+	}
+
+	return (char*) snd->mmap_buffer + snd_frames_to_bytes(snd, snd_offset);
+}
+
+/*
+ * non-interleaved version of snd_mmap_begin()
+ *
+ * areas is an array with one element per channel. It's
+ * filled with the address of each channel at appl_ptr.
+ */
+int
+snd_mmap_begin_n(struct snd *snd, void **areas, unsigned int *frames)
+{
+	long snd_offset;
+	unsigned int i;
+
+	if (snd->mmap_areas == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	snd_offset = mmap_region(snd, frames);
+	if (snd_offset == -1)
+		return -1;
+
+	for (i = 0; i < snd->channels; i++)
+		areas[i] = (char*) snd->mmap_areas[i] +
+		           snd_offset * snd->bytes_per_sample;
+
+	return 0;
+}
+
+/*
+ * commit frames transferred in the region returned by
+ * snd_mmap_begin()
+ *
+ * frames must not be greater than the value returned
+ * by snd_mmap_begin() in its frames argument.
+ */
+int
+snd_mmap_commit(struct snd *snd, unsigned int frames)
+{
+	return snd_update_appl_ptr(snd, frames);
+}
+
+/*
+ * copy frames from/to ring buffer starting at appl_ptr
+ *
+ * The ring buffer wrap is handled here. appl_ptr is
+ * not published to ALSA, the advanced one is returned
+ * instead.
+ */
+static unsigned long
+mmap_copy(struct snd *snd, unsigned long appl_ptr, void *buffer,
+          unsigned int user_offset, unsigned int frames)
 {
 	/* offset in sound device buffer */
 	unsigned int snd_offset;
@@ -90,37 +257,265 @@ snd_mmap_transfer(struct snd *snd, void *buffer, unsigned int frames)
 	/* size to be copied */
 	unsigned int copy;
 
-	unsigned int user_offset = 0;
-
-	if (frames > snd->buffer_size)
-		frames = snd->buffer_size;
-
 	while (frames) {
 		copy = frames;
 
 		/* get the transfer offset in ring buffer */
-		snd_offset = snd->control->appl_ptr % snd->buffer_size;
+		snd_offset = appl_ptr % snd->buffer_size;
 
 		/* we can only copy frames if they are continuous */
 		continuous = snd->buffer_size - snd_offset;
 		if (copy > continuous)
 			copy = continuous;
 
-		snd_mmap_areas_copy(snd, snd_offset, (char*) buffer,
-		                    user_offset, copy);
+		snd_mmap_areas_copy(snd, snd_offset, buffer, user_offset, copy);
 
-		snd_update_appl_ptr(snd, copy);
+		appl_ptr = pointer_add(snd, appl_ptr, copy);
 
 		user_offset += copy;
 		frames -= copy;
 	}
 
-	return frames;
+	return appl_ptr;
+}
+
+/*
+ * get available frames, waiting for them if necessary
+ *
+ * Available frames are calculated from the last known
+ * hardware pointer. If there is none and SND_NONBLOCK
+ * is set, -1 is returned and errno is set to EAGAIN.
+ * In xrun state, errno is set to EPIPE.
+ *
+ * If status isn't mmaped, the known hardware pointer is
+ * only as new as the last ioctl(), so it's synchronized
+ * first.
+ */
+static long
+mmap_wait_avail(struct snd *snd)
+{
+	struct pollfd pfd;
+	unsigned long avail;
+
+	if (snd->sync_ptr != NULL && snd_sync(snd, SND_SYNC_HW) < 0)
+		return -1;
+
+	while (1) {
+		if (snd->status->state == SND_STATE_XRUN) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		avail = snd_avail(snd);
+		if (avail)
+			return avail;
+
+		if (snd->flags & SND_NONBLOCK) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		pfd.fd = snd->fd;
+		pfd.events = snd->type & SND_INPUT ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, -1) == -1)
+			return -1;
+
+		if (snd_sync(snd, SND_SYNC_HW) < 0)
+			return -1;
+	}
+}
+
+/*
+ * transfer several buffers in sequence
+ *
+ * Only available frames are transferred, so audio not
+ * yet played (or captured audio not yet read) is never
+ * overwritten.
+ *
+ * If SND_NONBLOCK is set, min(requested, avail) frames
+ * are transferred and appl_ptr is published only once.
+ * Otherwise, it waits until all frames are transferred,
+ * publishing appl_ptr once per wait.
+ *
+ * Return the number of frames transferred, i.e. with
+ * appl_ptr published. If none could be transferred,
+ * return -1 with errno set to EAGAIN (no room) or EPIPE
+ * (xrun).
+ */
+ssize_t
+snd_mmap_transfer_batch(struct snd *snd, struct snd_buffer *buffers,
+                        unsigned int count)
+{
+	unsigned long appl_ptr, published;
+	long avail;
+	ssize_t total = 0;
+	/* total before this wait */
+	ssize_t previous;
+	/* frames already transferred in buffers[i] */
+	unsigned int done = 0;
+	unsigned int frames;
+	unsigned int i = 0;
+
+	/* skip empty buffers */
+	while (i < count && buffers[i].frames == 0)
+		i++;
+
+	while (i < count) {
+		avail = mmap_wait_avail(snd);
+		if (avail < 0)
+			return total ? total : -1;
+
+		published = snd->control->appl_ptr;
+		appl_ptr = published;
+		previous = total;
+
+		while (i < count && avail) {
+			frames = buffers[i].frames - done;
+			if (frames > avail)
+				frames = avail;
+
+			appl_ptr = mmap_copy(snd, appl_ptr, buffers[i].data,
+			                     done, frames);
+
+			done += frames;
+			avail -= frames;
+			total += frames;
+
+			if (done == buffers[i].frames) {
+				done = 0;
+				i++;
+			}
+		}
+
+		snd->control->appl_ptr = appl_ptr;
+
+		/* ALSA didn't take the frames of this wait */
+		if (snd_sync(snd, SND_SYNC_SET) < 0) {
+			snd->control->appl_ptr = published;
+			return previous ? previous : -1;
+		}
+
+		if (snd->flags & SND_NONBLOCK)
+			break;
+	}
+
+	return total;
+}
+
+ssize_t
+snd_mmap_transfer(struct snd *snd, void *buffer, unsigned int frames)
+{
+	struct snd_buffer b = {buffer, frames};
+
+	return snd_mmap_transfer_batch(snd, &b, 1);
+}
+
+/*
+ * Rewind/forward
+ * ==============
+ *
+ * Move appl_ptr backward (rewind) or forward. In
+ * playback, rewind allows replacing audio already
+ * written but not yet played. ALSA updates appl_ptr,
+ * it's then synchronized back to struct snd.
+ */
+
+/*
+ * frames that can be safely rewound
+ *
+ * hw_ptr is requested to hardware. In playback, frames
+ * in hardware FIFO can't be rewound. In capture, frames
+ * already read and still in the buffer can be rewound.
+ */
+long
+snd_rewindable(struct snd *snd)
+{
+	long frames;
+
+	if (snd_sync(snd, SND_SYNC_HW) < 0)
+		return -1;
+
+	frames = snd->buffer_size - snd_avail(snd);
+	if (snd->type == SND_OUTPUT)
+		frames -= snd->fifo_size;
+
+	return frames > 0 ? frames : 0;
+}
+
+/* frames that can be skipped */
+long
+snd_forwardable(struct snd *snd)
+{
+	if (snd_sync(snd, SND_SYNC_HW) < 0)
+		return -1;
+
+	return snd_avail(snd);
+}
+
+/* ALSA returns in frames the number of frames moved */
+static long
+move_appl_ptr(struct snd *snd, unsigned long request,
+              unsigned int frames)
+{
+	snd_pcm_uframes_t f = frames;
+
+	if (frames == 0)
+		return 0;
+
+	if (ioctl(snd->fd, request, &f) == -1)
+		return -1;
+
+	if (snd_sync(snd, SND_SYNC_GET) < 0)
+		return -1;
+
+	return f;
+}
+
+/*
+ * rewind up to 'frames', bounded by snd_rewindable()
+ *
+ * Return the number of frames rewound.
+ */
+long
+snd_rewind(struct snd *snd, unsigned int frames)
+{
+	long rewindable = snd_rewindable(snd);
+
+	if (rewindable < 0)
+		return -1;
+	if (frames > rewindable)
+		frames = rewindable;
+
+	return move_appl_ptr(snd, SNDRV_PCM_IOCTL_REWIND, frames);
+}
+
+/*
+ * forward up to 'frames', bounded by snd_forwardable()
+ *
+ * Return the number of frames skipped.
+ */
+long
+snd_forward(struct snd *snd, unsigned int frames)
+{
+	long forwardable = snd_forwardable(snd);
+
+	if (forwardable < 0)
+		return -1;
+	if (frames > forwardable)
+		frames = forwardable;
+
+	return move_appl_ptr(snd, SNDRV_PCM_IOCTL_FORWARD, frames);
 }
 
 /*
  * RW access
  * =========
+ *
+ * ALSA in kernel bounds the transfer to the available
+ * frames when SND_NONBLOCK is set. On error, -1 is
+ * returned and errno is kept as set by ioctl(), i.e.
+ * EAGAIN (no room) or EPIPE (xrun).
  */
 
 ssize_t
@@ -139,31 +534,132 @@ snd_ioctl_transfer(struct snd *snd, void *buffer, unsigned int frames)
 		tmp = ioctl(snd->fd, SNDRV_PCM_IOCTL_READI_FRAMES, &x);
 	else
 		tmp = ioctl(snd->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x);
-	if (tmp == -1) {
-		/* error handling */
-		if (errno == EPIPE) {
-			/* xrun */
-			// snd->xruns++;
-		}
+	if (tmp == -1)
 		return -1;
-	}
 
 	return x.result;
 }
 
+/*
+ * non-interleaved version of snd_ioctl_transfer()
+ *
+ * buffer is an array of buffers, one per channel.
+ */
+ssize_t
+snd_ioctl_transfer_n(struct snd *snd, void *buffer, unsigned int frames)
+{
+	/* non-interleaved transfer structure */
+	struct snd_xfern x;
+
+	int tmp;
+
+	x.bufs = buffer;
+	x.frames = frames;
+	x.result = 0;
+
+	if (snd->type & SND_INPUT)
+		tmp = ioctl(snd->fd, SNDRV_PCM_IOCTL_READN_FRAMES, &x);
+	else
+		tmp = ioctl(snd->fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &x);
+	if (tmp == -1)
+		return -1;
+
+	return x.result;
+}
+
+/*
+ * transfer several buffers in sequence, one ioctl per
+ * buffer
+ *
+ * Stop at the first buffer that is not completely
+ * transferred. Return the number of frames transferred,
+ * or -1 if no frame could be transferred.
+ */
+ssize_t
+snd_ioctl_transferv(struct snd *snd, struct snd_buffer *buffers,
+                    unsigned int count)
+{
+	ssize_t total = 0;
+	ssize_t tmp;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		tmp = snd->transfer(snd, buffers[i].data, buffers[i].frames);
+		if (tmp == -1)
+			return total ? total : -1;
+
+		total += tmp;
+
+		if (tmp < buffers[i].frames)
+			break;
+	}
+
+	return total;
+}
+
 /*
  * generic read/write
  * ==================
+ *
+ * If SND_RECOVER is set and an xrun happens, recover and
+ * retry once.
  */
 
+static inline int
+should_recover(struct snd *snd, ssize_t result)
+{
+	return result == -1 && errno == EPIPE && snd->flags & SND_RECOVER &&
+	       snd_recover(snd) == 0;
+}
+
 int
 snd_write(struct snd *snd, const void *data, unsigned int frames)
 {
-	return snd->transfer(snd, (void*) data, frames);
+	ssize_t tmp;
+
+	tmp = snd->transfer(snd, (void*) data, frames);
+	if (should_recover(snd, tmp))
+		tmp = snd->transfer(snd, (void*) data, frames);
+
+	return tmp;
 }
 
 int
 snd_read(struct snd *snd, void *data, unsigned int frames)
 {
-	return snd->transfer(snd, data, frames);
+	ssize_t tmp;
+
+	tmp = snd->transfer(snd, data, frames);
+	if (should_recover(snd, tmp))
+		tmp = snd->transfer(snd, data, frames);
+
+	return tmp;
+}
+
+/* write several buffers in sequence */
+int
+snd_writev(struct snd *snd, const struct snd_buffer *buffers,
+           unsigned int count)
+{
+	ssize_t tmp;
+
+	tmp = snd->transferv(snd, (struct snd_buffer*) buffers, count);
+	if (should_recover(snd, tmp))
+		tmp = snd->transferv(snd, (struct snd_buffer*) buffers,
+		                     count);
+
+	return tmp;
+}
+
+/* read into several buffers in sequence */
+int
+snd_readv(struct snd *snd, struct snd_buffer *buffers, unsigned int count)
+{
+	ssize_t tmp;
+
+	tmp = snd->transferv(snd, buffers, count);
+	if (should_recover(snd, tmp))
+		tmp = snd->transferv(snd, buffers, count);
+
+	return tmp;
 }
@@ -27,15 +27,45 @@
  */
 
 int
-snd_mmap_areas_copy(struct snd *snd, unsigned int pcm_offset, char *buf,
+snd_mmap_areas_copy(struct snd *snd, unsigned int pcm_offset, void *buf,
                       unsigned int user_offset, unsigned int frames);
 
 int
 snd_update_appl_ptr(struct snd *snd, unsigned int frames);
 
+void *
+snd_mmap_begin(struct snd *snd, unsigned int *frames);
+
+int
+snd_mmap_begin_n(struct snd *snd, void **areas, unsigned int *frames);
+
+int
+snd_mmap_commit(struct snd *snd, unsigned int frames);
+
+ssize_t
+snd_mmap_transfer_batch(struct snd *snd, struct snd_buffer *buffers,
+                        unsigned int count);
+
 ssize_t
 snd_mmap_transfer(struct snd *snd, void *buffer, unsigned int bytes);
 
+/*
+ * Rewind/forward
+ * ==============
+ */
+
+long
+snd_rewindable(struct snd *snd);
+
+long
+snd_forwardable(struct snd *snd);
+
+long
+snd_rewind(struct snd *snd, unsigned int frames);
+
+long
+snd_forward(struct snd *snd, unsigned int frames);
+
 /*
  * RW access
  * =========
@@ -44,6 +74,13 @@ snd_mmap_transfer(struct snd *snd, void *buffer, unsigned int bytes);
 ssize_t
 snd_ioctl_transfer(struct snd *snd, void *buffer, unsigned int bytes);
 
+ssize_t
+snd_ioctl_transfer_n(struct snd *snd, void *buffer, unsigned int bytes);
+
+ssize_t
+snd_ioctl_transferv(struct snd *snd, struct snd_buffer *buffers,
+                    unsigned int count);
+
 /*
  * Generic read/write
  * ==================
@@ -55,4 +92,11 @@ snd_write(struct snd *snd, const void *data, unsigned int bytes);
 int
 snd_read(struct snd *snd, void *data, unsigned int bytes);
 
+int
+snd_writev(struct snd *snd, const struct snd_buffer *buffers,
+           unsigned int count);
+
+int
+snd_readv(struct snd *snd, struct snd_buffer *buffers, unsigned int count);
+
 #endif /* SOUND_TRANSFER_H */
@@ -0,0 +1,235 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Mixing bus
+ *
+ * Many producer threads submit audio into one output.
+ * Each producer owns a voice: a single producer, single
+ * consumer queue of period buffers. Voices are attached
+ * to a slot of the bus with a compare-and-swap, so no
+ * lock is taken by producers nor by the audio thread.
+ *
+ * Once per period, the audio thread takes the ready
+ * buffer of every voice and sums them all in one pass.
+ * A voice with no buffer ready is skipped and accounted,
+ * the mix never waits for it.
+ */
+
+#include <stdlib.h> /* malloc(), calloc(), free() */
+
+#include "mix_bus.h"
+#include "mix_utility.h" /* sndmix_n() */
+
+static inline unsigned int
+sample_bytes(struct mix_bus *bus)
+{
+	return snd_format_to_bytes(bus->format);
+}
+
+static inline size_t
+period_bytes(struct mix_bus *bus)
+{
+	return (size_t) bus->samples * sample_bytes(bus);
+}
+
+/*
+ * Producer side
+ * =============
+ */
+
+/*
+ * create a voice of 'count' period buffers and attach
+ * it to the bus
+ *
+ * Can be called from any thread. Return -1 if bus has no
+ * free slot.
+ */
+int
+mix_voice_open(struct mix_voice *voice, struct mix_bus *bus,
+               unsigned int count)
+{
+	struct mix_voice *expected;
+	unsigned int i;
+
+	voice->bus = bus;
+	voice->count = count;
+	voice->head = 0;
+	voice->tail = 0;
+	voice->underfed = 0;
+	voice->closing = 0;
+	voice->detached = 0;
+
+	voice->buffers = malloc(period_bytes(bus) * count);
+	if (!voice->buffers)
+		return -1;
+
+	/* publish the voice after it's initialized */
+	for (i = 0; i < bus->max_voices; i++) {
+		expected = NULL;
+		if (__atomic_compare_exchange_n(&bus->voices[i], &expected,
+		                                voice, 0, __ATOMIC_RELEASE,
+		                                __ATOMIC_RELAXED))
+			return 0;
+	}
+
+	free(voice->buffers);
+	return -1;
+}
+
+/*
+ * ask audio thread to detach the voice
+ *
+ * Buffers already submitted are still mixed. Memory of
+ * the voice is released when mix_voice_detached() returns
+ * nonzero.
+ */
+void
+mix_voice_close(struct mix_voice *voice)
+{
+	__atomic_store_n(&voice->closing, 1, __ATOMIC_RELEASE);
+}
+
+int
+mix_voice_detached(struct mix_voice *voice)
+{
+	if (!__atomic_load_n(&voice->detached, __ATOMIC_ACQUIRE))
+		return 0;
+
+	free(voice->buffers);
+	voice->buffers = NULL;
+
+	return 1;
+}
+
+/*
+ * get a free period buffer to be filled
+ *
+ * Return NULL if all buffers are waiting to be mixed.
+ */
+void *
+mix_voice_get(struct mix_voice *voice)
+{
+	if (voice->head - __atomic_load_n(&voice->tail, __ATOMIC_ACQUIRE) >=
+	    voice->count)
+		return NULL;
+
+	return voice->buffers +
+	       (voice->head % voice->count) * period_bytes(voice->bus);
+}
+
+/* submit the buffer from mix_voice_get() */
+void
+mix_voice_submit(struct mix_voice *voice)
+{
+	__atomic_store_n(&voice->head, voice->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Audio thread side
+ * =================
+ */
+
+/*
+ * mix a period of all ready voices into 'dst'
+ *
+ * Called by the audio thread only. 'dst' is silence if
+ * no voice is ready. Return the number of voices mixed.
+ */
+unsigned int
+mix_bus_mix(struct mix_bus *bus, void *dst)
+{
+	const void *src[bus->max_voices];
+	struct mix_voice *ready[bus->max_voices];
+	struct mix_voice *voice;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < bus->max_voices; i++) {
+		voice = __atomic_load_n(&bus->voices[i], __ATOMIC_ACQUIRE);
+		if (voice == NULL)
+			continue;
+
+		if (__atomic_load_n(&voice->head, __ATOMIC_ACQUIRE) ==
+		    voice->tail) {
+			/* drained voice being closed is detached */
+			if (__atomic_load_n(&voice->closing,
+			                    __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&bus->voices[i], NULL,
+				                 __ATOMIC_RELAXED);
+				__atomic_store_n(&voice->detached, 1,
+				                 __ATOMIC_RELEASE);
+				continue;
+			}
+
+			voice->underfed++;
+			bus->underfed++;
+			continue;
+		}
+
+		src[count] = voice->buffers + (voice->tail % voice->count) *
+		                              period_bytes(bus);
+		ready[count++] = voice;
+	}
+
+	sndmix_n(dst, src, count, bus->samples, bus->format);
+
+	/* give buffers back to producers */
+	for (i = 0; i < count; i++)
+		__atomic_store_n(&ready[i]->tail, ready[i]->tail + 1,
+		                 __ATOMIC_RELEASE);
+
+	return count;
+}
+
+/*
+ * Setup
+ * =====
+ */
+
+/*
+ * format is one of SND_FORMAT_* mixed by sndmix_n().
+ * samples is the number of samples (frames * channels)
+ * in a period.
+ */
+int
+mix_bus_open(struct mix_bus *bus, unsigned int format, unsigned int samples,
+             unsigned int max_voices)
+{
+	/* an empty mix tells whether format is supported */
+	if (sndmix_n(NULL, NULL, 0, 0, format) == -1)
+		return -1;
+
+	bus->format = format;
+	bus->samples = samples;
+	bus->max_voices = max_voices;
+	bus->underfed = 0;
+
+	bus->voices = calloc(max_voices, sizeof(*bus->voices));
+	if (!bus->voices)
+		return -1;
+
+	return 0;
+}
+
+/* all voices must be detached */
+void
+mix_bus_close(struct mix_bus *bus)
+{
+	free(bus->voices);
+}
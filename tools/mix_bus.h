@@ -0,0 +1,91 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIX_BUS_H
+#define MIX_BUS_H
+
+#include "sound_global.h" /* SND_CACHE_LINE */
+
+struct mix_bus;
+
+/*
+ * A voice is a queue of 'count' period buffers owned by
+ * one producer thread. The producer takes a free buffer,
+ * fills it and submits it. The audio thread mixes and
+ * frees it.
+ */
+struct mix_voice {
+	struct mix_bus *bus;
+
+	char *buffers;
+	unsigned int count;
+
+	/*
+	 * Buffers submitted (producer) and mixed (audio
+	 * thread). Each side writes its own cache line.
+	 */
+	unsigned long head __attribute__((aligned(SND_CACHE_LINE)));
+	unsigned long tail __attribute__((aligned(SND_CACHE_LINE)));
+
+	/* periods the voice had no buffer ready */
+	unsigned long underfed;
+
+	/* set by producer, then by audio thread when it's gone */
+	int closing;
+	int detached;
+};
+
+struct mix_bus {
+	/* sample format and samples in a period */
+	unsigned int format;
+	unsigned int samples;
+
+	struct mix_voice **voices;
+	unsigned int max_voices;
+
+	/* total of periods voices had no buffer ready */
+	unsigned long underfed;
+};
+
+int
+mix_bus_open(struct mix_bus *bus, unsigned int format, unsigned int samples,
+             unsigned int max_voices);
+
+void
+mix_bus_close(struct mix_bus *bus);
+
+unsigned int
+mix_bus_mix(struct mix_bus *bus, void *dst);
+
+int
+mix_voice_open(struct mix_voice *voice, struct mix_bus *bus,
+               unsigned int count);
+
+void
+mix_voice_close(struct mix_voice *voice);
+
+int
+mix_voice_detached(struct mix_voice *voice);
+
+void *
+mix_voice_get(struct mix_voice *voice);
+
+void
+mix_voice_submit(struct mix_voice *voice);
+
+#endif /* MIX_BUS_H */
@@ -0,0 +1,214 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Client of mix_server
+ *
+ * Connect to the server and receive the ring and the
+ * eventfd. Frames are written into the ring without any
+ * system call. The connection is kept open only to tell
+ * the server when the client is gone.
+ */
+
+#include <errno.h>      /* errno */
+#include <poll.h>       /* poll() */
+#include <stdint.h>     /* uint64_t */
+#include <string.h>     /* memcpy(), memset() */
+#include <sys/mman.h>   /* mmap(), munmap() */
+#include <sys/socket.h> /* socket(), connect(), recvmsg() */
+#include <sys/stat.h>   /* fstat() */
+#include <unistd.h>     /* read(), close() */
+
+#include "mix_server.h"
+
+/* receive ring and eventfd */
+static int
+receive_fds(int sock, int *fds)
+{
+	char control[CMSG_SPACE(sizeof(int) * 2)];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t ret;
+	char byte;
+
+	memset(&msg, 0, sizeof(msg));
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (ret != 1) {
+		/* server is full or has gone */
+		if (ret == 0)
+			errno = ECONNREFUSED;
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 2)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 2);
+
+	return 0;
+}
+
+/* connect to server 'name' (NULL is the default one) */
+int
+mix_client_open(struct mix_client *c, const char *name)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	socklen_t len;
+	int fds[2];
+
+	len = mix_server_address(&addr, name);
+
+	c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (c->sock == -1)
+		return -1;
+
+	if (connect(c->sock, (struct sockaddr*) &addr, len) == -1 ||
+	    receive_fds(c->sock, fds) == -1)
+		goto _go_close_sock;
+
+	c->fd = fds[1];
+
+	if (fstat(fds[0], &st) == -1)
+		goto _go_close_fds;
+
+	c->size = st.st_size;
+	c->ring = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               fds[0], 0);
+	if (c->ring == MAP_FAILED)
+		goto _go_close_fds;
+
+	/* the mapping is enough */
+	close(fds[0]);
+
+	return 0;
+
+_go_close_fds:
+	close(fds[1]);
+	close(fds[0]);
+_go_close_sock:
+	close(c->sock);
+	return -1;
+}
+
+/* leave the mix, frames not mixed yet are dropped */
+void
+mix_client_close(struct mix_client *c)
+{
+	close(c->sock);
+	close(c->fd);
+	munmap(c->ring, c->size);
+}
+
+/*
+ * push frames into ring
+ *
+ * Never blocks. Return the number of frames pushed,
+ * which is less than 'frames' if ring is full.
+ */
+unsigned int
+mix_client_write(struct mix_client *c, const void *data, unsigned int frames)
+{
+	struct mix_server_ring *ring = c->ring;
+	unsigned long write_ptr = ring->write_ptr;
+	unsigned int offset, continuous;
+	unsigned int room;
+
+	room = ring->size - (write_ptr - __atomic_load_n(&ring->read_ptr,
+	                                                 __ATOMIC_ACQUIRE));
+	if (frames > room)
+		frames = room;
+	if (frames == 0)
+		return 0;
+
+	offset = write_ptr % ring->size;
+	continuous = ring->size - offset;
+	if (continuous > frames)
+		continuous = frames;
+
+	memcpy(ring->data + offset * ring->bytes_per_frame, data,
+	       continuous * ring->bytes_per_frame);
+	memcpy(ring->data, (const char*) data +
+	       continuous * ring->bytes_per_frame,
+	       (frames - continuous) * ring->bytes_per_frame);
+
+	__atomic_store_n(&ring->write_ptr, write_ptr + frames,
+	                 __ATOMIC_RELEASE);
+
+	return frames;
+}
+
+/*
+ * wait up to 'timeout' milliseconds (-1 is forever)
+ * until there is room for 'frames' frames
+ *
+ * Return 1 if there is room, 0 on timeout and -1 on
+ * error. errno is EPIPE if server has gone.
+ */
+int
+mix_client_wait(struct mix_client *c, unsigned int frames, int timeout)
+{
+	struct mix_server_ring *ring = c->ring;
+	struct pollfd pfd[2];
+	uint64_t value;
+
+	if (frames > ring->size)
+		frames = ring->size;
+
+	pfd[0].fd = c->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = c->sock;
+	pfd[1].events = 0; /* only hang up */
+
+	ring->watermark = frames;
+
+	while (mix_server_ring_room(ring) < frames) {
+		/* server checks it after moving read_ptr */
+		__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+		if (mix_server_ring_room(ring) >= frames)
+			break;
+
+		if (poll(pfd, 2, timeout) == -1)
+			return -1;
+		if (pfd[1].revents) {
+			errno = EPIPE;
+			return -1;
+		}
+		if (pfd[0].revents == 0)
+			return 0;
+		if (read(c->fd, &value, sizeof(value)) == -1 &&
+		    errno != EAGAIN)
+			return -1;
+	}
+
+	return 1;
+}
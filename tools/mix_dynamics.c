@@ -0,0 +1,293 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dynamics of a float mix
+ *
+ * Final stage of a mix done with sndmix_n_float(), before
+ * conversion to the sound device format. Instead of hard
+ * clamping (audible distortion), the compressor lowers
+ * the level smoothly above a threshold and the limiter
+ * guarantees nothing goes above full scale.
+ *
+ * Both work on interleaved frames in place. Gain applies
+ * to all channels of a frame.
+ */
+
+#include <math.h>   /* fabsf(), expf(), log10f(), powf() */
+#include <stdlib.h> /* malloc(), calloc(), free() */
+
+#include "mix_dynamics.h"
+
+/*
+ * frames of a compressor block. Gain is computed once per
+ * block, the logarithms are not paid per frame.
+ */
+#define COMPRESSOR_BLOCK  16
+
+static inline float
+db_to_linear(float db)
+{
+	return powf(10.0f, db / 20);
+}
+
+/* smoothing coefficient per frame for a time constant */
+static inline float
+time_coefficient(unsigned int rate, float ms)
+{
+	if (ms <= 0.0f)
+		return 0.0f;
+	return expf(-1000.0f / (ms * rate));
+}
+
+/* largest absolute sample, of a frame or of a block */
+static inline float
+samples_peak(const float *samples, unsigned int count)
+{
+	float peak = 0.0f;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (fabsf(samples[i]) > peak)
+			peak = fabsf(samples[i]);
+	}
+
+	return peak;
+}
+
+static inline void
+frame_gain(float *frame, unsigned int channels, float gain)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++)
+		frame[c] *= gain;
+}
+
+/*
+ * Compressor
+ * ==========
+ *
+ * Gain reduction is computed from the peak of a block
+ * of COMPRESSOR_BLOCK frames, in dB, and smoothed per
+ * block. Gain then goes linearly from the one of the
+ * previous block to the new one along the block.
+ */
+
+void
+mix_compressor_init(struct mix_compressor *c, unsigned int channels,
+                    unsigned int rate, float threshold_db, float ratio,
+                    float attack_ms, float release_ms, float makeup_db)
+{
+	c->channels = channels;
+	c->threshold = threshold_db;
+	c->slope = ratio > 1.0f ? 1.0f - 1.0f / ratio : 0.0f;
+	c->makeup = db_to_linear(makeup_db);
+	c->attack = time_coefficient(rate, attack_ms / COMPRESSOR_BLOCK);
+	c->release = time_coefficient(rate, release_ms / COMPRESSOR_BLOCK);
+	c->reduction = 0.0f;
+	c->gain = c->makeup;
+}
+
+void
+mix_compressor_run(struct mix_compressor *c, float *buffer,
+                   unsigned int frames)
+{
+	unsigned int channels = c->channels;
+	float peak, target, coefficient;
+	float gain, step;
+	unsigned int length, f;
+
+	for (; frames; frames -= length) {
+		length = frames < COMPRESSOR_BLOCK ? frames : COMPRESSOR_BLOCK;
+		peak = samples_peak(buffer, length * channels);
+
+		/* gain reduction above threshold */
+		target = 0.0f;
+		if (peak > 0.0f) {
+			target = c->threshold - 20 * log10f(peak);
+			if (target < 0.0f)
+				target *= c->slope;
+			else
+				target = 0.0f;
+		}
+
+		/* more reduction is attack, less is release */
+		coefficient = target < c->reduction ? c->attack : c->release;
+		if (length < COMPRESSOR_BLOCK)
+			coefficient = powf(coefficient,
+			                   (float) length / COMPRESSOR_BLOCK);
+		c->reduction = target + coefficient * (c->reduction - target);
+
+		gain = db_to_linear(c->reduction) * c->makeup;
+		step = (gain - c->gain) / length;
+		for (f = 1; f <= length; f++, buffer += channels)
+			frame_gain(buffer, channels, c->gain + step * f);
+		c->gain = gain;
+	}
+}
+
+/*
+ * Limiter
+ * =======
+ *
+ * For each frame, the gain that brings it to ceiling is
+ * computed. The gain applied to a frame leaving the delay
+ * line is the average, over the window, of the minimum
+ * required gain of the window. A peak is in all the
+ * minimums averaged when it leaves the delay line, so it
+ * is never above ceiling, and gain changes take a whole
+ * window (no clicks).
+ */
+
+int
+mix_limiter_open(struct mix_limiter *l, unsigned int channels,
+                 unsigned int rate, unsigned int lookahead,
+                 float ceiling_db, float release_ms)
+{
+	unsigned int i;
+
+	l->channels = channels;
+	l->window = lookahead + 1;
+	l->ceiling = db_to_linear(ceiling_db);
+	l->release = time_coefficient(rate, release_ms);
+
+	/* one more frame, so it's never a zero size */
+	l->delay = calloc(l->window * channels, sizeof(*l->delay));
+	l->min_frame = malloc(l->window * sizeof(*l->min_frame));
+	l->min_gain = malloc(l->window * sizeof(*l->min_gain));
+	l->gains = malloc(l->window * sizeof(*l->gains));
+	if (!l->delay || !l->min_frame || !l->min_gain || !l->gains) {
+		mix_limiter_close(l);
+		return -1;
+	}
+
+	for (i = 0; i < l->window; i++)
+		l->gains[i] = 1.0f;
+	l->gain_sum = l->window;
+
+	l->min_head = 0;
+	l->min_count = 0;
+	l->envelope = 1.0f;
+	l->frame = 0;
+
+	return 0;
+}
+
+void
+mix_limiter_close(struct mix_limiter *l)
+{
+	free(l->gains);
+	free(l->min_gain);
+	free(l->min_frame);
+	free(l->delay);
+}
+
+/* minimum of the required gains in window */
+static float
+window_minimum(struct mix_limiter *l, float gain)
+{
+	unsigned int tail;
+
+	/* drop the one leaving the window */
+	if (l->min_count &&
+	    l->frame - l->min_frame[l->min_head] >= l->window) {
+		l->min_head = (l->min_head + 1) % l->window;
+		l->min_count--;
+	}
+
+	/* drop required gains that are not smaller than the new one */
+	while (l->min_count) {
+		tail = (l->min_head + l->min_count - 1) % l->window;
+		if (l->min_gain[tail] < gain)
+			break;
+		l->min_count--;
+	}
+
+	tail = (l->min_head + l->min_count) % l->window;
+	l->min_frame[tail] = l->frame;
+	l->min_gain[tail] = gain;
+	l->min_count++;
+
+	return l->min_gain[l->min_head];
+}
+
+/* sum of gains in window, without accumulated error */
+static double
+window_sum(struct mix_limiter *l)
+{
+	double sum = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < l->window; i++)
+		sum += l->gains[i];
+
+	return sum;
+}
+
+void
+mix_limiter_run(struct mix_limiter *l, float *buffer, unsigned int frames)
+{
+	unsigned int channels = l->channels;
+	unsigned int pos;
+	unsigned int c;
+	float *delayed;
+	float peak, gain, tmp;
+
+	for (; frames--; buffer += channels, l->frame++) {
+		peak = samples_peak(buffer, channels);
+		gain = peak > l->ceiling ? l->ceiling / peak : 1.0f;
+
+		/* gain goes down at once and back up slowly */
+		gain = window_minimum(l, gain);
+		if (gain < l->envelope)
+			l->envelope = gain;
+		else
+			l->envelope = gain + l->release * (l->envelope - gain);
+
+		/* moving average, summed again every window */
+		pos = l->frame % l->window;
+		l->gain_sum += l->envelope - l->gains[pos];
+		l->gains[pos] = l->envelope;
+		if (pos == 0)
+			l->gain_sum = window_sum(l);
+
+		/*
+		 * Reduced gain is rounded down a bit, so float
+		 * error never lets a peak above ceiling.
+		 */
+		gain = l->gain_sum / l->window;
+		if (gain >= 1.0f)
+			gain = 1.0f;
+		else
+			gain *= 0.99999f;
+
+		/* put the frame in and take the one delayed out */
+		if (l->window > 1) {
+			delayed = l->delay + l->frame % (l->window - 1) *
+			          channels;
+			for (c = 0; c < channels; c++) {
+				tmp = delayed[c];
+				delayed[c] = buffer[c];
+				buffer[c] = tmp;
+			}
+		}
+
+		frame_gain(buffer, channels, gain);
+	}
+}
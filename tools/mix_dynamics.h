@@ -0,0 +1,102 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIX_DYNAMICS_H
+#define MIX_DYNAMICS_H
+
+/*
+ * Feed-forward compressor
+ * =======================
+ *
+ * Gain is the same for all channels (linked), computed
+ * from the peak of each block of 16 frames.
+ */
+struct mix_compressor {
+	unsigned int channels;
+
+	float threshold; /* dB */
+	float slope;     /* 1 - 1 / ratio */
+	float makeup;    /* linear */
+
+	/* smoothing of gain reduction per block */
+	float attack;
+	float release;
+
+	/* gain reduction, dB (negative or zero) */
+	float reduction;
+
+	/* linear gain at the end of the last block */
+	float gain;
+};
+
+void
+mix_compressor_init(struct mix_compressor *c, unsigned int channels,
+                    unsigned int rate, float threshold_db, float ratio,
+                    float attack_ms, float release_ms, float makeup_db);
+
+void
+mix_compressor_run(struct mix_compressor *c, float *buffer,
+                   unsigned int frames);
+
+/*
+ * Look-ahead limiter
+ * ==================
+ *
+ * Output never goes above ceiling. Output is delayed by
+ * 'lookahead' frames, so gain goes down smoothly before a
+ * peak arrives.
+ */
+struct mix_limiter {
+	unsigned int channels;
+	/* lookahead + 1 */
+	unsigned int window;
+
+	float ceiling; /* linear */
+	float release;
+
+	/* delay line of lookahead frames */
+	float *delay;
+
+	/* minimum required gain in window (ascending deque) */
+	unsigned long *min_frame;
+	float *min_gain;
+	unsigned int min_head;
+	unsigned int min_count;
+
+	/* moving average of gain in window */
+	float *gains;
+	double gain_sum;
+
+	/* released gain */
+	float envelope;
+
+	unsigned long frame;
+};
+
+int
+mix_limiter_open(struct mix_limiter *l, unsigned int channels,
+                 unsigned int rate, unsigned int lookahead,
+                 float ceiling_db, float release_ms);
+
+void
+mix_limiter_close(struct mix_limiter *l);
+
+void
+mix_limiter_run(struct mix_limiter *l, float *buffer, unsigned int frames);
+
+#endif /* MIX_DYNAMICS_H */
@@ -0,0 +1,594 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Local sound server
+ *
+ * Owns a playback device and mixes the audio of client
+ * processes into it. Clients connect to an abstract Unix
+ * socket and receive a ring (memfd) and an eventfd (see
+ * mix_server.h and mix_client.c).
+ *
+ * A single audio thread, with real-time priority when
+ * allowed, runs a snd_engine: once per period it mixes
+ * every client that has a period of frames straight into
+ * the mmaped device buffer. The main thread only accepts
+ * and removes clients.
+ *
+ * It can be tried without a sound card, loading the
+ * snd-dummy or snd-aloop kernel modules.
+ */
+
+#define _GNU_SOURCE /* memfd_create(), accept4() */
+
+#include <errno.h>       /* errno */
+#include <poll.h>        /* poll() */
+#include <pthread.h>     /* pthread_*() */
+#include <sched.h>       /* SCHED_FIFO */
+#include <signal.h>      /* signal() */
+#include <stdint.h>      /* uint64_t */
+#include <stdio.h>       /* printf(), fprintf() */
+#include <stdlib.h>      /* atoi(), calloc(), free() */
+#include <string.h>      /* memset(), memcpy() */
+#include <sys/eventfd.h> /* eventfd() */
+#include <sys/mman.h>    /* mmap(), memfd_create() */
+#include <sys/socket.h>  /* socket(), bind(), sendmsg() */
+#include <time.h>        /* nanosleep() */
+#include <unistd.h>      /* getopt(), write(), close() */
+
+#include "sound.h"
+#include "mix_server.h"
+#include "mix_utility.h"
+
+#define FORMAT    SND_FORMAT_S16_LE
+#define CHANNELS  2
+
+/* ring of a client, in periods */
+#define RING_PERIODS  4
+
+#define AUDIO_PRIORITY  80
+
+#define BACKLOG  8
+
+/*
+ * The ring is writable by the client, so the server keeps
+ * its own size and read_ptr and only loads write_ptr.
+ */
+struct client {
+	struct mix_server_ring *ring;
+	size_t size;
+
+	/* frames of ring and frames mixed, copied to the ring */
+	unsigned int ring_size;
+	unsigned long read_ptr;
+
+	int sock;
+	int event_fd;
+
+	/* set by main thread, then by audio thread when it's gone */
+	int closing;
+	int detached;
+};
+
+struct server {
+	struct snd pcm;
+	struct snd_engine engine;
+
+	unsigned int ring_size; /* frames */
+
+	int listen_fd;
+
+	/*
+	 * Added by main thread, removed by audio thread when
+	 * the client is closing.
+	 */
+	struct client *clients[MIX_SERVER_CLIENTS];
+
+	pthread_t thread;
+	int done; /* audio thread has returned */
+};
+
+static volatile sig_atomic_t _keep_running = 1;
+
+static void
+on_signal(int sig)
+{
+	signal(sig, SIG_IGN);
+	_keep_running = 0;
+}
+
+/*
+ * Audio thread
+ * ============
+ */
+
+/* frames written by client and not mixed yet, at most the ring */
+static unsigned long
+filled(struct client *c)
+{
+	unsigned long frames;
+
+	frames = __atomic_load_n(&c->ring->write_ptr, __ATOMIC_ACQUIRE) -
+	         c->read_ptr;
+
+	return frames < c->ring_size ? frames : c->ring_size;
+}
+
+/*
+ * signal client if it waits for room
+ *
+ * It fails only if the eventfd counter is full, and then
+ * the client is woken up already.
+ */
+static int
+notify(struct client *c)
+{
+	struct mix_server_ring *ring = c->ring;
+	uint64_t one = 1;
+
+	if (!__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST) ||
+	    c->ring_size - filled(c) < ring->watermark)
+		return 0;
+
+	if (!__atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+		return 0;
+
+	return write(c->event_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+/*
+ * mix a period of every client that has it
+ *
+ * A client whose ring wraps in the period is mixed in
+ * two pieces, so there is no copy.
+ */
+static int
+process(void **in, void **out, unsigned int frames,
+        const struct snd_engine_time *time, void *data)
+{
+	struct server *s = data;
+	struct client *mixing[MIX_SERVER_CLIENTS];
+	const void *src[MIX_SERVER_CLIENTS];
+	unsigned int bytes = s->pcm.bytes_per_frame;
+	unsigned int count = 0;
+	unsigned int offset, chunk, done;
+	struct client *c;
+	unsigned int i;
+
+	for (i = 0; i < MIX_SERVER_CLIENTS; i++) {
+		c = __atomic_load_n(&s->clients[i], __ATOMIC_ACQUIRE);
+		if (!c)
+			continue;
+
+		if (__atomic_load_n(&c->closing, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&s->clients[i], NULL, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->detached, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		if (filled(c) < frames) {
+			c->ring->underfed++;
+			continue;
+		}
+
+		mixing[count++] = c;
+	}
+
+	for (done = 0; done < frames; done += chunk) {
+		chunk = frames - done;
+		for (i = 0; i < count; i++) {
+			c = mixing[i];
+			offset = (c->read_ptr + done) % c->ring_size;
+			if (chunk > c->ring_size - offset)
+				chunk = c->ring_size - offset;
+		}
+
+		for (i = 0; i < count; i++) {
+			c = mixing[i];
+			offset = (c->read_ptr + done) % c->ring_size;
+			src[i] = c->ring->data + offset * bytes;
+		}
+
+		sndmix_n((char*) out[0] + done * bytes, src, count,
+		         chunk * s->pcm.channels, FORMAT);
+	}
+
+	for (i = 0; i < count; i++) {
+		c = mixing[i];
+		c->read_ptr += frames;
+		__atomic_store_n(&c->ring->read_ptr, c->read_ptr,
+		                 __ATOMIC_SEQ_CST);
+		notify(c);
+	}
+
+	return 0;
+}
+
+static void *
+audio_thread(void *arg)
+{
+	struct server *s = arg;
+
+	if (snd_engine_run(&s->engine) == -1)
+		fprintf(stderr, "Error playing: %s\n", strerror(errno));
+
+	__atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* start audio thread, with real-time priority if allowed */
+static int
+start_audio_thread(struct server *s)
+{
+	struct sched_param param = {.sched_priority = AUDIO_PRIORITY};
+	pthread_attr_t attr;
+	int ret;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	ret = pthread_create(&s->thread, &attr, audio_thread, s);
+	pthread_attr_destroy(&attr);
+	if (ret == 0)
+		return 0;
+
+	fprintf(stderr, "No real-time priority, see set_cap_sys_nice.sh\n");
+
+	if (pthread_create(&s->thread, NULL, audio_thread, s) != 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Clients
+ * =======
+ */
+
+/* send ring and eventfd */
+static int
+send_fds(int sock, int *fds)
+{
+	char control[CMSG_SPACE(sizeof(int) * 2)];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char byte = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 2);
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1)
+		return -1;
+
+	return 0;
+}
+
+static void
+free_client(struct client *c)
+{
+	munmap(c->ring, c->size);
+	close(c->event_fd);
+	close(c->sock);
+	free(c);
+}
+
+/* create ring and eventfd of a client and send them */
+static struct client *
+new_client(struct server *s, int sock)
+{
+	struct mix_server_ring *ring;
+	struct client *c;
+	int fds[2];
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->sock = sock;
+	c->size = sizeof(*ring) +
+	          snd_frames_to_bytes(&s->pcm, s->ring_size);
+
+	fds[0] = memfd_create("mix-client", MFD_CLOEXEC);
+	if (fds[0] == -1)
+		goto _go_free;
+
+	if (ftruncate(fds[0], c->size) == -1)
+		goto _go_close_memfd;
+
+	c->ring = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               fds[0], 0);
+	if (c->ring == MAP_FAILED)
+		goto _go_close_memfd;
+
+	ring = c->ring;
+	ring->format = FORMAT;
+	ring->channels = s->pcm.channels;
+	ring->rate = s->pcm.rate;
+	ring->bytes_per_frame = s->pcm.bytes_per_frame;
+	ring->size = s->ring_size;
+	ring->watermark = s->engine.period;
+	c->ring_size = s->ring_size;
+
+	c->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fds[1] = c->event_fd;
+	if (c->event_fd == -1)
+		goto _go_unmap;
+
+	if (send_fds(sock, fds) == -1)
+		goto _go_close_eventfd;
+
+	/* the mapping is enough */
+	close(fds[0]);
+
+	return c;
+
+_go_close_eventfd:
+	close(c->event_fd);
+_go_unmap:
+	munmap(c->ring, c->size);
+_go_close_memfd:
+	close(fds[0]);
+_go_free:
+	free(c);
+	return NULL;
+}
+
+static void
+accept_client(struct server *s)
+{
+	struct client *c;
+	unsigned int i;
+	int sock;
+
+	sock = accept4(s->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (sock == -1)
+		return;
+
+	for (i = 0; i < MIX_SERVER_CLIENTS; i++) {
+		if (!__atomic_load_n(&s->clients[i], __ATOMIC_RELAXED))
+			break;
+	}
+
+	/* full, client gets nothing */
+	if (i == MIX_SERVER_CLIENTS) {
+		close(sock);
+		return;
+	}
+
+	c = new_client(s, sock);
+	if (!c) {
+		close(sock);
+		return;
+	}
+
+	__atomic_store_n(&s->clients[i], c, __ATOMIC_RELEASE);
+}
+
+/* take a client out of the mix and free it */
+static void
+remove_client(struct server *s, struct client *c)
+{
+	struct timespec ts = {0, 1000000}; /* 1 millisecond */
+
+	__atomic_store_n(&c->closing, 1, __ATOMIC_RELEASE);
+
+	/* audio thread lets it go in its next period */
+	while (!__atomic_load_n(&c->detached, __ATOMIC_ACQUIRE) &&
+	       !__atomic_load_n(&s->done, __ATOMIC_ACQUIRE))
+		nanosleep(&ts, NULL);
+
+	free_client(c);
+}
+
+/*
+ * Main thread
+ * ===========
+ */
+
+/* accept and remove clients until interrupted */
+static void
+serve(struct server *s)
+{
+	struct pollfd pfd[MIX_SERVER_CLIENTS + 1];
+	struct client *clients[MIX_SERVER_CLIENTS];
+	struct client *c;
+	unsigned int count;
+	unsigned int i;
+	char byte;
+
+	while (_keep_running && !__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+		pfd[0].fd = s->listen_fd;
+		pfd[0].events = POLLIN;
+
+		count = 0;
+		for (i = 0; i < MIX_SERVER_CLIENTS; i++) {
+			c = __atomic_load_n(&s->clients[i], __ATOMIC_RELAXED);
+			if (!c)
+				continue;
+			clients[count] = c;
+			pfd[count + 1].fd = c->sock;
+			pfd[count + 1].events = POLLIN;
+			count++;
+		}
+
+		/* wake up now and then to see if audio thread is done */
+		if (poll(pfd, count + 1, 500) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* a client doesn't send anything, it's gone */
+		for (i = 0; i < count; i++) {
+			if (pfd[i + 1].revents &&
+			    recv(pfd[i + 1].fd, &byte, 1, MSG_DONTWAIT) <= 0)
+				remove_client(s, clients[i]);
+		}
+
+		if (pfd[0].revents)
+			accept_client(s);
+	}
+}
+
+static int
+run(unsigned int card, unsigned int device, unsigned int rate,
+    unsigned int period_size, unsigned int period_count, const char *name)
+{
+	struct snd_config config;
+	struct snd *pcms[1];
+	struct sockaddr_un addr;
+	struct server *s;
+	struct client *c;
+	unsigned int i;
+	socklen_t len;
+	int ret = -1;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -1;
+
+	memset(&config, 0, sizeof(config));
+	config.card =         card;
+	config.device =       device;
+	config.flags =        SND_OUTPUT | SND_MMAP | SND_RECOVER;
+	config.format =       FORMAT;
+	config.channels =     CHANNELS;
+	config.rate =         rate;
+	config.period_size =  period_size;
+	config.period_count = period_count;
+	config.prefill =      period_size;
+
+	if (snd_open(&s->pcm, &config) == -1) {
+		fprintf(stderr, "Unable to open sound device\n");
+		goto _go_free;
+	}
+
+	pcms[0] = &s->pcm;
+	if (snd_engine_open(&s->engine, pcms, 1, period_size, process,
+	                    s) == -1) {
+		fprintf(stderr, "Unable to start engine\n");
+		goto _go_close_snd;
+	}
+
+	s->ring_size = period_size * RING_PERIODS;
+
+	s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s->listen_fd == -1)
+		goto _go_close_engine;
+
+	len = mix_server_address(&addr, name);
+	if (bind(s->listen_fd, (struct sockaddr*) &addr, len) == -1 ||
+	    listen(s->listen_fd, BACKLOG) == -1) {
+		fprintf(stderr, "Unable to listen on '%s'\n", addr.sun_path + 1);
+		goto _go_close_listen;
+	}
+
+	printf("Channels: %u, %u Hz, %u-bits, period %u, server '%s'\n",
+	       CHANNELS, rate, snd_format_to_bytes(FORMAT) * 8, period_size,
+	       addr.sun_path + 1);
+
+	if (start_audio_thread(s) == -1)
+		goto _go_close_listen;
+
+	serve(s);
+
+	snd_engine_stop(&s->engine);
+	pthread_join(s->thread, NULL);
+
+	for (i = 0; i < MIX_SERVER_CLIENTS; i++) {
+		c = s->clients[i];
+		if (c)
+			free_client(c);
+	}
+
+	ret = 0;
+
+_go_close_listen:
+	close(s->listen_fd);
+_go_close_engine:
+	snd_engine_close(&s->engine);
+_go_close_snd:
+	snd_close(&s->pcm);
+_go_free:
+	free(s);
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	int opt;
+	unsigned int device = 0;
+	unsigned int card = 0;
+	unsigned int rate = 48000;
+	unsigned int period_size = 256;
+	unsigned int period_count = 4;
+	char *name = NULL;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	/* parse command line arguments */
+	while ((opt = getopt(argc, argv, "c:d:r:p:n:s:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			card = atoi(optarg);
+			break;
+		case 'd':
+			device = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'p':
+			period_size = atoi(optarg);
+			break;
+		case 'n':
+			period_count = atoi(optarg);
+			break;
+		case 's':
+			name = optarg;
+			break;
+		default:
+			printf("usage: cmd [-c card] [-d device] [-r rate] "
+			       "[-p period_size] [-n n_periods] "
+			       "[-s server name]\n");
+			return 1;
+		}
+	}
+
+	return run(card, device, rate, period_size, period_count, name) ?
+	       1 : 0;
+}
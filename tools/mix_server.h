@@ -0,0 +1,122 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIX_SERVER_H
+#define MIX_SERVER_H
+
+#include <stddef.h>     /* offsetof(), size_t */
+#include <stdio.h>      /* snprintf() */
+#include <string.h>     /* memset(), strlen() */
+#include <sys/socket.h> /* socklen_t */
+#include <sys/un.h>     /* struct sockaddr_un */
+
+#include "sound_global.h" /* SND_CACHE_LINE */
+
+#define MIX_SERVER_NAME     "simplesound-mix"
+#define MIX_SERVER_CLIENTS  16
+
+/*
+ * Ring of a client
+ * ================
+ *
+ * In a memfd created by the server for each client, with
+ * an eventfd. Both are passed to the client when it
+ * connects. Client writes frames in server's format
+ * (interleaved) and server mixes them, a period at a
+ * time. Neither side makes a system call per period.
+ *
+ * If client sets 'waiting', server signals the eventfd
+ * when room reaches 'watermark'.
+ */
+
+struct mix_server_ring {
+	/* set by server */
+	unsigned int format;
+	unsigned int channels;
+	unsigned int rate;
+	unsigned int bytes_per_frame;
+	unsigned int size; /* frames */
+
+	/* periods server had not a period of frames to mix */
+	unsigned long underfed;
+
+	/* set by client */
+	unsigned int watermark;
+	int waiting;
+
+	/* frames written (client) and mixed (server) */
+	unsigned long write_ptr __attribute__((aligned(SND_CACHE_LINE)));
+	unsigned long read_ptr __attribute__((aligned(SND_CACHE_LINE)));
+
+	char data[] __attribute__((aligned(SND_CACHE_LINE)));
+};
+
+/* room for client, seen from either side */
+static inline unsigned int
+mix_server_ring_room(struct mix_server_ring *ring)
+{
+	unsigned long write_ptr, read_ptr;
+
+	write_ptr = __atomic_load_n(&ring->write_ptr, __ATOMIC_SEQ_CST);
+	read_ptr = __atomic_load_n(&ring->read_ptr, __ATOMIC_SEQ_CST);
+
+	return ring->size - (write_ptr - read_ptr);
+}
+
+/* address in the abstract namespace, NULL is the default name */
+static inline socklen_t
+mix_server_address(struct sockaddr_un *addr, const char *name)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s",
+	         name ? name : MIX_SERVER_NAME);
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 +
+	       strlen(addr->sun_path + 1);
+}
+
+/*
+ * Client side
+ * ===========
+ */
+
+struct mix_client {
+	struct mix_server_ring *ring;
+	size_t size;
+
+	/* eventfd, see mix_client_wait() */
+	int fd;
+
+	/* connection to server, closing it leaves the mix */
+	int sock;
+};
+
+int
+mix_client_open(struct mix_client *c, const char *name);
+
+void
+mix_client_close(struct mix_client *c);
+
+unsigned int
+mix_client_write(struct mix_client *c, const void *data, unsigned int frames);
+
+int
+mix_client_wait(struct mix_client *c, unsigned int frames, int timeout);
+
+#endif /* MIX_SERVER_H */
@@ -0,0 +1,103 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Play a sine tone through mix_server
+ *
+ * Several of them, with different frequencies, can be
+ * run at once to try the server.
+ */
+
+#include <math.h>   /* sin(), M_PI */
+#include <stdint.h> /* int16_t */
+#include <stdio.h>  /* printf(), fprintf() */
+#include <stdlib.h> /* atof() */
+#include <string.h> /* strerror() */
+#include <errno.h>  /* errno */
+#include <unistd.h> /* getopt() */
+
+#include "mix_server.h"
+#include "sound_parameters.h" /* SND_FORMAT_S16_LE */
+
+#define PERIOD  256 /* frames written at a time */
+
+int
+main(int argc, char **argv)
+{
+	struct mix_client client;
+	int16_t buffer[PERIOD * 8];
+	double frequency = 440.0;
+	double seconds = 5.0;
+	double phase = 0.0;
+	unsigned long frames, total;
+	unsigned int channels;
+	unsigned int i, c;
+	char *name = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:s:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			frequency = atof(optarg);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 's':
+			name = optarg;
+			break;
+		default:
+			printf("usage: cmd [-f frequency] [-t seconds] "
+			       "[-s server name]\n");
+			return 1;
+		}
+	}
+
+	if (mix_client_open(&client, name) == -1) {
+		fprintf(stderr, "Unable to connect: %s\n", strerror(errno));
+		return 1;
+	}
+
+	channels = client.ring->channels;
+	if (client.ring->format != SND_FORMAT_S16_LE || channels > 8) {
+		fprintf(stderr, "Server format is not supported\n");
+		mix_client_close(&client);
+		return 1;
+	}
+
+	total = seconds * client.ring->rate;
+	for (frames = 0; frames < total; frames += PERIOD) {
+		for (i = 0; i < PERIOD; i++) {
+			for (c = 0; c < channels; c++)
+				buffer[i * channels + c] = 8192 * sin(phase);
+			phase += 2 * M_PI * frequency / client.ring->rate;
+		}
+
+		if (mix_client_wait(&client, PERIOD, -1) != 1) {
+			fprintf(stderr, "Server has gone\n");
+			break;
+		}
+		mix_client_write(&client, buffer, PERIOD);
+	}
+
+	printf("Periods not mixed in time: %lu\n", client.ring->underfed);
+
+	mix_client_close(&client);
+
+	return 0;
+}
@@ -21,11 +21,12 @@
  *
  * sound mix utility
  *
- * Based on alsa-lib's dmix plugin
- *
- * sum is used to store the sum of all samples mixed into
- * dst. sum is necessary because dst can't store a value
- * greater than its resolution:
+ * All sources are mixed in a single pass. The sum of a
+ * range of samples is kept in an accumulator twice the
+ * sample size (registers, or a small tile that stays in
+ * cache), and saturated once when stored in dst. dst
+ * can't store a value greater than its resolution, but
+ * the sum can:
  *
  *  ============ sum max
  *       .-.
@@ -35,58 +36,1525 @@
  *  dst min ============
  *                  `-´
  *  sum min ============
+ *
+ * Each source is read once and dst is written once, no
+ * matter how many sources there are.
  */
 
+#include <math.h>   /* fabsf(), lrintf(), powf(), sinf(), cosf() */
 #include <stdint.h> /* int*_t */
 
-void
-sndmix_16(int16_t *dst, int16_t *src, int32_t *sum, unsigned int samples)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* SSE2 and AVX2 intrinsics */
+#define MIX_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>  /* NEON intrinsics */
+#define MIX_NEON
+#endif
+
+#include "mix_utility.h"
+
+/* samples summed at once in the scalar version */
+#define MIX_TILE  256
+
+/* range of 24-bit samples */
+#define S24_MAX  8388607
+#define S24_MIN  (-8388608)
+
+/*
+ * 24-bit vector versions sum in 32-bit lanes, which hold
+ * up to 256 full-scale samples. The scalar version sums
+ * in 64 bits and takes over above that.
+ */
+#define S24_VECTOR_SOURCES  256
+
+/*
+ * Float full scale is [-1.0, 1.0). Largest float below
+ * 2^31 is used as maximum of 32-bit, since INT32_MAX is
+ * not representable.
+ */
+#define FLOAT_S16_SCALE  32768.0f
+#define FLOAT_S16_MAX    32767.0f
+#define FLOAT_S24_SCALE  8388608.0f
+#define FLOAT_S24_MAX    8388607.0f
+#define FLOAT_S32_SCALE  2147483648.0f
+#define FLOAT_S32_MAX    2147483520.0f
+
+/* frames of a linear piece of an exponential ramp */
+#define MIX_SEGMENT  32
+
+/* exponential ramps go from and to at least -80 dB */
+#define GAIN_FLOOR  0.0001f
+
+/*
+ * 16-bit gain is Q14 (gain * 16384), ramped in Q28 to
+ * keep the fraction of the change per frame
+ */
+#define GAIN_Q28  268435456.0f
+#define GAIN_MAX  (32767.0f / 16384)
+#define GAIN_MIN  -2.0f
+
+/* sign extend the low 24 bits of a 32-bit container */
+static inline int32_t
+s24_load(int32_t sample)
+{
+	return (int32_t) ((uint32_t) sample << 8) >> 8;
+}
+
+static inline int32_t
+s24_3le_load(const uint8_t *p)
+{
+	return (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 |
+	                  (uint32_t) p[2] << 24) >> 8;
+}
+
+static inline void
+s24_3le_store(uint8_t *p, int32_t sample)
 {
+	p[0] = sample;
+	p[1] = sample >> 8;
+	p[2] = sample >> 16;
+}
+
+static inline int32_t
+s24_clamp(int64_t sample)
+{
+	if (sample > S24_MAX)
+		return S24_MAX;
+	if (sample < S24_MIN)
+		return S24_MIN;
+	return sample;
+}
+
+/* scale and clamp in float, then round to nearest even */
+static inline int32_t
+float_to_int(float sample, float scale, float max)
+{
+	sample *= scale;
+	if (sample > max)
+		sample = max;
+	if (sample < -scale)
+		sample = -scale;
+	return lrintf(sample);
+}
+
+/*
+ * Scalar reference
+ * ================
+ *
+ * Vector versions below must give exactly the same
+ * output. They also handle the samples that don't fill
+ * a vector by calling these with an offset.
+ */
+
+static void
+mix_16_from(int16_t *dst, const int16_t **src, unsigned int count,
+            unsigned int offset, unsigned int samples)
+{
+	int32_t sum[MIX_TILE];
 	int32_t sample;
+	unsigned int tile;
+	unsigned int i, j;
 
-	while (samples--) {
-		sample = *src;
+	for (; offset < samples; offset += tile) {
+		tile = samples - offset;
+		if (tile > MIX_TILE)
+			tile = MIX_TILE;
 
-		if (*dst == 0) {
-			*sum = *dst = sample;
-		} else {
-			*sum += sample;
-			sample = *sum;
+		for (i = 0; i < tile; i++)
+			sum[i] = 0;
+
+		for (j = 0; j < count; j++) {
+			for (i = 0; i < tile; i++)
+				sum[i] += src[j][offset + i];
+		}
+
+		for (i = 0; i < tile; i++) {
+			sample = sum[i];
 			if (sample > INT16_MAX)
 				sample = INT16_MAX;
 			else if (sample < INT16_MIN)
 				sample = INT16_MIN;
-			*dst = sample;
+			dst[offset + i] = sample;
 		}
-
-		src++;
-		dst++;
-		sum++;
 	}
 }
 
-void
-sndmix_32(int32_t *dst, int32_t *src, int64_t *sum, unsigned int samples)
+static void
+mix_32_from(int32_t *dst, const int32_t **src, unsigned int count,
+            unsigned int offset, unsigned int samples)
 {
+	int64_t sum[MIX_TILE];
 	int64_t sample;
+	unsigned int tile;
+	unsigned int i, j;
+
+	for (; offset < samples; offset += tile) {
+		tile = samples - offset;
+		if (tile > MIX_TILE)
+			tile = MIX_TILE;
 
-	while (samples--) {
-		sample = *src;
+		for (i = 0; i < tile; i++)
+			sum[i] = 0;
 
-		if (*dst == 0) {
-			*sum = *dst = sample;
-		} else {
-			*sum += sample;
-			sample = *sum;
+		for (j = 0; j < count; j++) {
+			for (i = 0; i < tile; i++)
+				sum[i] += src[j][offset + i];
+		}
+
+		for (i = 0; i < tile; i++) {
+			sample = sum[i];
 			if (sample > INT32_MAX)
 				sample = INT32_MAX;
 			else if (sample < INT32_MIN)
 				sample = INT32_MIN;
-			*dst = sample;
+			dst[offset + i] = sample;
+		}
+	}
+}
+
+void
+sndmix_n_16_generic(int16_t *dst, const int16_t **src, unsigned int count,
+                    unsigned int samples)
+{
+	mix_16_from(dst, src, count, 0, samples);
+}
+
+void
+sndmix_n_32_generic(int32_t *dst, const int32_t **src, unsigned int count,
+                    unsigned int samples)
+{
+	mix_32_from(dst, src, count, 0, samples);
+}
+
+static void
+mix_float_from(float *dst, const float **src, unsigned int count,
+               unsigned int offset, unsigned int samples)
+{
+	float sum[MIX_TILE];
+	unsigned int tile;
+	unsigned int i, j;
+
+	for (; offset < samples; offset += tile) {
+		tile = samples - offset;
+		if (tile > MIX_TILE)
+			tile = MIX_TILE;
+
+		for (i = 0; i < tile; i++)
+			sum[i] = 0.0f;
+
+		for (j = 0; j < count; j++) {
+			for (i = 0; i < tile; i++)
+				sum[i] += src[j][offset + i];
+		}
+
+		for (i = 0; i < tile; i++)
+			dst[offset + i] = sum[i];
+	}
+}
+
+static void
+mix_s24_from(int32_t *dst, const int32_t **src, unsigned int count,
+             unsigned int offset, unsigned int samples)
+{
+	int64_t sum[MIX_TILE];
+	unsigned int tile;
+	unsigned int i, j;
+
+	for (; offset < samples; offset += tile) {
+		tile = samples - offset;
+		if (tile > MIX_TILE)
+			tile = MIX_TILE;
+
+		for (i = 0; i < tile; i++)
+			sum[i] = 0;
+
+		for (j = 0; j < count; j++) {
+			for (i = 0; i < tile; i++)
+				sum[i] += s24_load(src[j][offset + i]);
+		}
+
+		for (i = 0; i < tile; i++)
+			dst[offset + i] = s24_clamp(sum[i]);
+	}
+}
+
+void
+sndmix_n_float_generic(float *dst, const float **src, unsigned int count,
+                       unsigned int samples)
+{
+	mix_float_from(dst, src, count, 0, samples);
+}
+
+void
+sndmix_n_s24_generic(int32_t *dst, const int32_t **src, unsigned int count,
+                     unsigned int samples)
+{
+	mix_s24_from(dst, src, count, 0, samples);
+}
+
+/*
+ * packed 24-bit is scalar only, samples are not aligned
+ * to vector lanes
+ */
+void
+sndmix_n_s24_3le(uint8_t *dst, const uint8_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	int64_t sum[MIX_TILE];
+	unsigned int offset;
+	unsigned int tile;
+	unsigned int i, j;
+
+	for (offset = 0; offset < samples; offset += tile) {
+		tile = samples - offset;
+		if (tile > MIX_TILE)
+			tile = MIX_TILE;
+
+		for (i = 0; i < tile; i++)
+			sum[i] = 0;
+
+		for (j = 0; j < count; j++) {
+			for (i = 0; i < tile; i++)
+				sum[i] += s24_3le_load(src[j] +
+				                       (offset + i) * 3);
+		}
+
+		for (i = 0; i < tile; i++)
+			s24_3le_store(dst + (offset + i) * 3,
+			              s24_clamp(sum[i]));
+	}
+}
+
+/*
+ * Float conversion
+ * ================
+ *
+ * A float mix is converted once to the format of the
+ * sound device.
+ */
+
+static void
+float_to_s16_from(int16_t *dst, const float *src, unsigned int offset,
+                  unsigned int samples)
+{
+	for (; offset < samples; offset++)
+		dst[offset] = float_to_int(src[offset], FLOAT_S16_SCALE,
+		                           FLOAT_S16_MAX);
+}
+
+static void
+float_to_s24_from(int32_t *dst, const float *src, unsigned int offset,
+                  unsigned int samples)
+{
+	for (; offset < samples; offset++)
+		dst[offset] = float_to_int(src[offset], FLOAT_S24_SCALE,
+		                           FLOAT_S24_MAX);
+}
+
+static void
+float_to_s32_from(int32_t *dst, const float *src, unsigned int offset,
+                  unsigned int samples)
+{
+	for (; offset < samples; offset++)
+		dst[offset] = float_to_int(src[offset], FLOAT_S32_SCALE,
+		                           FLOAT_S32_MAX);
+}
+
+void
+sndmix_float_to_s16_generic(int16_t *dst, const float *src,
+                            unsigned int samples)
+{
+	float_to_s16_from(dst, src, 0, samples);
+}
+
+void
+sndmix_float_to_s24_generic(int32_t *dst, const float *src,
+                            unsigned int samples)
+{
+	float_to_s24_from(dst, src, 0, samples);
+}
+
+void
+sndmix_float_to_s32_generic(int32_t *dst, const float *src,
+                            unsigned int samples)
+{
+	float_to_s32_from(dst, src, 0, samples);
+}
+
+void
+sndmix_float_to_s24_3le(uint8_t *dst, const float *src, unsigned int samples)
+{
+	unsigned int i;
+
+	for (i = 0; i < samples; i++)
+		s24_3le_store(dst + i * 3, float_to_int(src[i],
+		              FLOAT_S24_SCALE, FLOAT_S24_MAX));
+}
+
+/*
+ * Dither
+ * ======
+ *
+ * Rounding a float mix to 16-bit leaves an error that
+ * follows the signal (distortion). Adding triangular
+ * (TPDF) noise of +-1 LSB before rounding makes the error
+ * a constant noise floor. With noise shaping, the error
+ * of the previous sample of the channel is subtracted
+ * (first-order), moving noise up to high frequencies.
+ *
+ * Random numbers come from xorshift32 generators, one per
+ * vector lane, owned by the caller (one state per thread
+ * or stream, no lock). Sample i uses generator i % 4, so
+ * vector and scalar versions draw the same numbers.
+ */
+
+/* error fed back is bounded, so clipping doesn't blow it up */
+#define DITHER_ERROR_MAX  2.0f
+
+static inline uint32_t
+xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/*
+ * two 16-bit uniform numbers summed, in LSB: triangular
+ * from -1.0 to 1.0 (exact in float)
+ */
+static inline float
+tpdf(uint32_t r)
+{
+	return (float) ((int32_t) ((r & 0xffff) + (r >> 16)) - 65535) *
+	       (1.0f / 65536);
+}
+
+void
+sndmix_dither_init(struct sndmix_dither *d, unsigned int channels,
+                   int shaping, uint32_t seed)
+{
+	unsigned int i;
+
+	/* error is kept for up to SNDMIX_DITHER_CHANNELS channels */
+	d->channels = channels;
+	d->shaping = shaping && channels > 0 &&
+	             channels <= SNDMIX_DITHER_CHANNELS;
+
+	/* xorshift state must not be zero */
+	for (i = 0; i < SNDMIX_DITHER_LANES; i++) {
+		seed = seed * 1664525 + 1013904223;
+		d->state[i] = seed ? seed : 1;
+	}
+
+	for (i = 0; i < SNDMIX_DITHER_CHANNELS; i++)
+		d->error[i] = 0.0f;
+}
+
+static inline int16_t
+dither_sample(float sample, float noise)
+{
+	sample += noise;
+	if (sample > FLOAT_S16_MAX)
+		sample = FLOAT_S16_MAX;
+	if (sample < -FLOAT_S16_SCALE)
+		sample = -FLOAT_S16_SCALE;
+	return lrintf(sample);
+}
+
+static void
+dither_from(int16_t *dst, const float *src, unsigned int offset,
+            unsigned int samples, struct sndmix_dither *d)
+{
+	for (; offset < samples; offset++)
+		dst[offset] = dither_sample(src[offset] * FLOAT_S16_SCALE,
+		              tpdf(xorshift32(&d->state[offset %
+		                                        SNDMIX_DITHER_LANES])));
+}
+
+/* error feedback is serial in each channel, so it's scalar only */
+static void
+dither_shaped(int16_t *dst, const float *src, unsigned int samples,
+              struct sndmix_dither *d)
+{
+	unsigned int channels = d->channels;
+	float sample, error;
+	unsigned int c = 0;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		sample = src[i] * FLOAT_S16_SCALE - d->error[c];
+		dst[i] = dither_sample(sample, tpdf(xorshift32(
+		         &d->state[i % SNDMIX_DITHER_LANES])));
+
+		error = dst[i] - sample;
+		if (error > DITHER_ERROR_MAX)
+			error = DITHER_ERROR_MAX;
+		else if (error < -DITHER_ERROR_MAX)
+			error = -DITHER_ERROR_MAX;
+		d->error[c] = error;
+
+		if (++c == channels)
+			c = 0;
+	}
+}
+
+void
+sndmix_float_to_s16_dither_generic(int16_t *dst, const float *src,
+                                   unsigned int samples,
+                                   struct sndmix_dither *d)
+{
+	if (d->shaping)
+		dither_shaped(dst, src, samples, d);
+	else
+		dither_from(dst, src, 0, samples, d);
+}
+
+/*
+ * Gain and pan
+ * ============
+ *
+ * A period is split in segments. In a segment, the gain
+ * of each channel of a voice is a line: a + b * frame.
+ * Linear ramps are exact. Exponential ones are lines of
+ * MIX_SEGMENT frames joined at exact values (otherwise a
+ * segment is a tile of MIX_TILE frames). The gain is
+ * computed while summing, there is no extra pass over
+ * the samples.
+ */
+
+/* index of channel in sndmix_gain.current[] */
+static inline unsigned int
+gain_channel(unsigned int channel, unsigned int channels)
+{
+	return channels == 2 ? channel : 0;
+}
+
+/* target gain of a channel, pan is constant power */
+static float
+channel_gain(const struct sndmix_gain *g, unsigned int channel,
+             unsigned int channels)
+{
+	float angle;
+
+	if (channels != 2)
+		return g->gain;
+
+	/* center is -3 dB in both channels */
+	angle = (g->pan + 1.0f) * (float) M_PI / 4;
+
+	return g->gain * (channel ? sinf(angle) : cosf(angle));
+}
+
+/* gain at 'frame' of a ramp of 'frames' frames */
+static float
+ramp_at(int ramp, float start, float end, unsigned int frame,
+        unsigned int frames)
+{
+	float sign;
+
+	if (frame == 0 || start == end)
+		return start;
+	if (frame >= frames)
+		return end;
+
+	/*
+	 * exponential on the magnitude, keeping the sign. It
+	 * can't cross zero, so a change of polarity is linear.
+	 */
+	if (ramp == SNDMIX_RAMP_EXP && start * end >= 0.0f) {
+		sign = start + end < 0.0f ? -1.0f : 1.0f;
+		start = fabsf(start);
+		end = fabsf(end);
+		if (start < GAIN_FLOOR)
+			start = GAIN_FLOOR;
+		if (end < GAIN_FLOOR)
+			end = GAIN_FLOOR;
+		return sign * start * powf(end / start, (float) frame / frames);
+	}
+
+	return start + (end - start) * frame / frames;
+}
+
+/* channels is the one the voice is mixed with */
+void
+sndmix_gain_init(struct sndmix_gain *g, float gain, float pan, int ramp,
+                 unsigned int channels)
+{
+	unsigned int c;
+
+	g->gain = gain;
+	g->pan = pan;
+	g->ramp = ramp;
+
+	/* no ramp at the first mix */
+	for (c = 0; c < SNDMIX_GAIN_CHANNELS; c++)
+		g->current[c] = channel_gain(g, c, channels);
+}
+
+/*
+ * Mix a segment with the gain of channel c of voice j
+ * being a[j * channels + c] + b[j * channels + c] * f,
+ * where f is the frame in the segment.
+ */
+typedef void (*segment_t) (void *dst, const void **src, const float *a,
+                           const float *b, unsigned int count,
+                           unsigned int frames, unsigned int channels);
+
+static void
+segment_float_generic(void *dst, const void **src, const float *a,
+                      const float *b, unsigned int count,
+                      unsigned int frames, unsigned int channels)
+{
+	const float **s = (const float**) src;
+	float *d = dst;
+	float sum[frames * channels];
+	const float *va, *vb;
+	unsigned int f, c, i, j;
+
+	for (i = 0; i < frames * channels; i++)
+		sum[i] = 0.0f;
+
+	for (j = 0; j < count; j++) {
+		va = a + j * channels;
+		vb = b + j * channels;
+		for (f = 0, i = 0; f < frames; f++) {
+			for (c = 0; c < channels; c++, i++)
+				sum[i] += s[j][i] * (va[c] + vb[c] * (float) f);
+		}
+	}
+
+	for (i = 0; i < frames * channels; i++)
+		d[i] = sum[i];
+}
+
+/* Q28 gain of a float one */
+static inline int32_t
+gain_q28(float gain)
+{
+	if (gain > GAIN_MAX)
+		gain = GAIN_MAX;
+	else if (gain < GAIN_MIN)
+		gain = GAIN_MIN;
+	return lrintf(gain * GAIN_Q28);
+}
+
+/* voice gain in Q28 and its change per frame */
+static void
+segment_q28(const float *a, const float *b, unsigned int frames,
+            unsigned int channels, int32_t *aq, int32_t *bq)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		aq[c] = gain_q28(a[c]);
+		bq[c] = (gain_q28(a[c] + b[c] * frames) - aq[c]) /
+		        (int32_t) frames;
+	}
+}
+
+static void
+segment_16_generic(void *dst, const void **src, const float *a,
+                   const float *b, unsigned int count, unsigned int frames,
+                   unsigned int channels)
+{
+	const int16_t **s = (const int16_t**) src;
+	int16_t *d = dst;
+	int32_t sum[frames * channels];
+	int32_t aq[channels], bq[channels];
+	int32_t gain;
+	unsigned int f, c, i, j;
+
+	for (i = 0; i < frames * channels; i++)
+		sum[i] = 0;
+
+	for (j = 0; j < count; j++) {
+		segment_q28(a + j * channels, b + j * channels, frames,
+		            channels, aq, bq);
+		for (f = 0, i = 0; f < frames; f++) {
+			for (c = 0; c < channels; c++, i++) {
+				gain = (aq[c] + bq[c] * (int32_t) f) >> 14;
+				sum[i] += (s[j][i] * gain) >> 14;
+			}
+		}
+	}
+
+	for (i = 0; i < frames * channels; i++) {
+		if (sum[i] > INT16_MAX)
+			d[i] = INT16_MAX;
+		else if (sum[i] < INT16_MIN)
+			d[i] = INT16_MIN;
+		else
+			d[i] = sum[i];
+	}
+}
+
+/*
+ * ramp all voices from their current gain to their
+ * target one, segment by segment
+ */
+static void
+mix_gain(void *dst, const void **src, struct sndmix_gain **gains,
+         unsigned int count, unsigned int frames, unsigned int channels,
+         unsigned int sample_bytes, segment_t segment)
+{
+	unsigned int n = (count ? count : 1) * channels;
+	float start[n], end[n], a[n], b[n];
+	const void *s[count ? count : 1];
+	unsigned int offset, length;
+	unsigned int segment_max = MIX_TILE;
+	unsigned int c, i, j;
+
+	/* targets are read once, they may change any time */
+	for (j = 0, i = 0; j < count; j++) {
+		for (c = 0; c < channels; c++, i++) {
+			start[i] = gains[j]->current[gain_channel(c,
+			                                          channels)];
+			end[i] = channel_gain(gains[j], c, channels);
+
+			if (start[i] != end[i] &&
+			    gains[j]->ramp == SNDMIX_RAMP_EXP)
+				segment_max = MIX_SEGMENT;
+		}
+	}
+
+	for (offset = 0; offset < frames; offset += length) {
+		length = frames - offset;
+		if (length > segment_max)
+			length = segment_max;
+
+		for (j = 0, i = 0; j < count; j++) {
+			for (c = 0; c < channels; c++, i++) {
+				a[i] = ramp_at(gains[j]->ramp, start[i], end[i],
+				               offset, frames);
+				b[i] = (ramp_at(gains[j]->ramp, start[i],
+				                end[i], offset + length,
+				                frames) - a[i]) / length;
+			}
+			s[j] = (const char*) src[j] +
+			       offset * channels * sample_bytes;
 		}
 
-		src++;
-		dst++;
-		sum++;
+		segment((char*) dst + offset * channels * sample_bytes, s,
+		        a, b, count, length, channels);
+	}
+
+	for (j = 0, i = 0; j < count; j++) {
+		for (c = 0; c < channels; c++, i++)
+			gains[j]->current[gain_channel(c, channels)] = end[i];
 	}
 }
+
+void
+sndmix_n_16_gain_generic(int16_t *dst, const int16_t **src,
+                         struct sndmix_gain **gains, unsigned int count,
+                         unsigned int frames, unsigned int channels)
+{
+	mix_gain(dst, (const void**) src, gains, count, frames, channels,
+	         sizeof(*dst), segment_16_generic);
+}
+
+void
+sndmix_n_float_gain_generic(float *dst, const float **src,
+                            struct sndmix_gain **gains, unsigned int count,
+                            unsigned int frames, unsigned int channels)
+{
+	mix_gain(dst, (const void**) src, gains, count, frames, channels,
+	         sizeof(*dst), segment_float_generic);
+}
+
+/*
+ * x86
+ * ===
+ *
+ * A block of samples is summed in registers across all
+ * sources, then saturated by the signed pack instructions
+ * (16-bit) or by 64-bit compares (32-bit).
+ */
+
+#ifdef MIX_X86
+
+__attribute__((target("sse2")))
+static void
+sndmix_n_16_sse2(int16_t *dst, const int16_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	__m128i s0, s1, sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 16 <= samples; offset += 16) {
+		sum0 = sum1 = sum2 = sum3 = _mm_setzero_si128();
+
+		for (j = 0; j < count; j++) {
+			s0 = _mm_loadu_si128((__m128i*) (src[j] + offset));
+			s1 = _mm_loadu_si128((__m128i*) (src[j] + offset + 8));
+
+			/* sign extend to 32-bit and accumulate */
+			sum0 = _mm_add_epi32(sum0,
+			       _mm_srai_epi32(_mm_unpacklo_epi16(s0, s0), 16));
+			sum1 = _mm_add_epi32(sum1,
+			       _mm_srai_epi32(_mm_unpackhi_epi16(s0, s0), 16));
+			sum2 = _mm_add_epi32(sum2,
+			       _mm_srai_epi32(_mm_unpacklo_epi16(s1, s1), 16));
+			sum3 = _mm_add_epi32(sum3,
+			       _mm_srai_epi32(_mm_unpackhi_epi16(s1, s1), 16));
+		}
+
+		_mm_storeu_si128((__m128i*) (dst + offset),
+		                 _mm_packs_epi32(sum0, sum1));
+		_mm_storeu_si128((__m128i*) (dst + offset + 8),
+		                 _mm_packs_epi32(sum2, sum3));
+	}
+
+	mix_16_from(dst, src, count, offset, samples);
+}
+
+__attribute__((target("avx2")))
+static void
+sndmix_n_16_avx2(int16_t *dst, const int16_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	__m256i s0, s1, sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 32 <= samples; offset += 32) {
+		sum0 = sum1 = sum2 = sum3 = _mm256_setzero_si256();
+
+		for (j = 0; j < count; j++) {
+			s0 = _mm256_loadu_si256((__m256i*) (src[j] + offset));
+			s1 = _mm256_loadu_si256((__m256i*) (src[j] + offset +
+			                                    16));
+
+			sum0 = _mm256_add_epi32(sum0, _mm256_cvtepi16_epi32(
+			       _mm256_castsi256_si128(s0)));
+			sum1 = _mm256_add_epi32(sum1, _mm256_cvtepi16_epi32(
+			       _mm256_extracti128_si256(s0, 1)));
+			sum2 = _mm256_add_epi32(sum2, _mm256_cvtepi16_epi32(
+			       _mm256_castsi256_si128(s1)));
+			sum3 = _mm256_add_epi32(sum3, _mm256_cvtepi16_epi32(
+			       _mm256_extracti128_si256(s1, 1)));
+		}
+
+		/* pack works in 128-bit lanes, put them in order */
+		s0 = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum0, sum1),
+		                              0xd8);
+		s1 = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum2, sum3),
+		                              0xd8);
+		_mm256_storeu_si256((__m256i*) (dst + offset), s0);
+		_mm256_storeu_si256((__m256i*) (dst + offset + 16), s1);
+	}
+
+	mix_16_from(dst, src, count, offset, samples);
+}
+
+/* SSE2 has no 64-bit compare, so 32-bit is AVX2 only */
+__attribute__((target("avx2")))
+static void
+sndmix_n_32_avx2(int32_t *dst, const int32_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+	const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+	/* low 32 bits of each 64-bit element */
+	const __m256i low = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	__m256i sum0, sum1;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 8 <= samples; offset += 8) {
+		sum0 = sum1 = _mm256_setzero_si256();
+
+		for (j = 0; j < count; j++) {
+			sum0 = _mm256_add_epi64(sum0, _mm256_cvtepi32_epi64(
+			       _mm_loadu_si128((__m128i*) (src[j] + offset))));
+			sum1 = _mm256_add_epi64(sum1, _mm256_cvtepi32_epi64(
+			       _mm_loadu_si128((__m128i*) (src[j] + offset +
+			                                   4))));
+		}
+
+		sum0 = _mm256_blendv_epi8(sum0, max,
+		                          _mm256_cmpgt_epi64(sum0, max));
+		sum0 = _mm256_blendv_epi8(sum0, min,
+		                          _mm256_cmpgt_epi64(min, sum0));
+		sum1 = _mm256_blendv_epi8(sum1, max,
+		                          _mm256_cmpgt_epi64(sum1, max));
+		sum1 = _mm256_blendv_epi8(sum1, min,
+		                          _mm256_cmpgt_epi64(min, sum1));
+
+		sum0 = _mm256_permutevar8x32_epi32(sum0, low);
+		sum1 = _mm256_permutevar8x32_epi32(sum1, low);
+		_mm256_storeu_si256((__m256i*) (dst + offset),
+		                    _mm256_permute2x128_si256(sum0, sum1,
+		                                              0x20));
+	}
+
+	mix_32_from(dst, src, count, offset, samples);
+}
+
+__attribute__((target("sse2")))
+static void
+sndmix_n_float_sse2(float *dst, const float **src, unsigned int count,
+                    unsigned int samples)
+{
+	__m128 sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 16 <= samples; offset += 16) {
+		sum0 = sum1 = sum2 = sum3 = _mm_setzero_ps();
+
+		for (j = 0; j < count; j++) {
+			sum0 = _mm_add_ps(sum0, _mm_loadu_ps(src[j] + offset));
+			sum1 = _mm_add_ps(sum1, _mm_loadu_ps(src[j] + offset +
+			                                     4));
+			sum2 = _mm_add_ps(sum2, _mm_loadu_ps(src[j] + offset +
+			                                     8));
+			sum3 = _mm_add_ps(sum3, _mm_loadu_ps(src[j] + offset +
+			                                     12));
+		}
+
+		_mm_storeu_ps(dst + offset, sum0);
+		_mm_storeu_ps(dst + offset + 4, sum1);
+		_mm_storeu_ps(dst + offset + 8, sum2);
+		_mm_storeu_ps(dst + offset + 12, sum3);
+	}
+
+	mix_float_from(dst, src, count, offset, samples);
+}
+
+__attribute__((target("avx")))
+static void
+sndmix_n_float_avx(float *dst, const float **src, unsigned int count,
+                   unsigned int samples)
+{
+	__m256 sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 32 <= samples; offset += 32) {
+		sum0 = sum1 = sum2 = sum3 = _mm256_setzero_ps();
+
+		for (j = 0; j < count; j++) {
+			sum0 = _mm256_add_ps(sum0, _mm256_loadu_ps(src[j] +
+			                                           offset));
+			sum1 = _mm256_add_ps(sum1, _mm256_loadu_ps(src[j] +
+			                                           offset + 8));
+			sum2 = _mm256_add_ps(sum2, _mm256_loadu_ps(src[j] +
+			                                           offset + 16));
+			sum3 = _mm256_add_ps(sum3, _mm256_loadu_ps(src[j] +
+			                                           offset + 24));
+		}
+
+		_mm256_storeu_ps(dst + offset, sum0);
+		_mm256_storeu_ps(dst + offset + 8, sum1);
+		_mm256_storeu_ps(dst + offset + 16, sum2);
+		_mm256_storeu_ps(dst + offset + 24, sum3);
+	}
+
+	mix_float_from(dst, src, count, offset, samples);
+}
+
+/* SSE2 has no 32-bit min/max, so 24-bit is AVX2 only */
+__attribute__((target("avx2")))
+static void
+sndmix_n_s24_avx2(int32_t *dst, const int32_t **src, unsigned int count,
+                  unsigned int samples)
+{
+	const __m256i max = _mm256_set1_epi32(S24_MAX);
+	const __m256i min = _mm256_set1_epi32(S24_MIN);
+	__m256i s, sum0, sum1;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 16 <= samples; offset += 16) {
+		sum0 = sum1 = _mm256_setzero_si256();
+
+		for (j = 0; j < count; j++) {
+			/* sign extend the low 24 bits */
+			s = _mm256_loadu_si256((__m256i*) (src[j] + offset));
+			sum0 = _mm256_add_epi32(sum0, _mm256_srai_epi32(
+			       _mm256_slli_epi32(s, 8), 8));
+			s = _mm256_loadu_si256((__m256i*) (src[j] + offset +
+			                                   8));
+			sum1 = _mm256_add_epi32(sum1, _mm256_srai_epi32(
+			       _mm256_slli_epi32(s, 8), 8));
+		}
+
+		sum0 = _mm256_max_epi32(_mm256_min_epi32(sum0, max), min);
+		sum1 = _mm256_max_epi32(_mm256_min_epi32(sum1, max), min);
+		_mm256_storeu_si256((__m256i*) (dst + offset), sum0);
+		_mm256_storeu_si256((__m256i*) (dst + offset + 8), sum1);
+	}
+
+	mix_s24_from(dst, src, count, offset, samples);
+}
+
+/*
+ * Conversion clamps in float, like float_to_int(), and
+ * the float to integer instruction rounds to nearest
+ * even (default rounding mode), like lrintf().
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+float_to_int_sse2(__m128 sample, float scale, float max)
+{
+	sample = _mm_mul_ps(sample, _mm_set1_ps(scale));
+	sample = _mm_min_ps(sample, _mm_set1_ps(max));
+	sample = _mm_max_ps(sample, _mm_set1_ps(-scale));
+	return _mm_cvtps_epi32(sample);
+}
+
+__attribute__((target("sse2")))
+static void
+sndmix_float_to_s16_sse2(int16_t *dst, const float *src,
+                         unsigned int samples)
+{
+	__m128i lo, hi;
+	unsigned int offset;
+
+	for (offset = 0; offset + 8 <= samples; offset += 8) {
+		lo = float_to_int_sse2(_mm_loadu_ps(src + offset),
+		                       FLOAT_S16_SCALE, FLOAT_S16_MAX);
+		hi = float_to_int_sse2(_mm_loadu_ps(src + offset + 4),
+		                       FLOAT_S16_SCALE, FLOAT_S16_MAX);
+		_mm_storeu_si128((__m128i*) (dst + offset),
+		                 _mm_packs_epi32(lo, hi));
+	}
+
+	float_to_s16_from(dst, src, offset, samples);
+}
+
+__attribute__((target("sse2")))
+static void
+sndmix_float_to_s24_sse2(int32_t *dst, const float *src,
+                         unsigned int samples)
+{
+	unsigned int offset;
+
+	for (offset = 0; offset + 4 <= samples; offset += 4)
+		_mm_storeu_si128((__m128i*) (dst + offset),
+		                 float_to_int_sse2(_mm_loadu_ps(src + offset),
+		                                   FLOAT_S24_SCALE,
+		                                   FLOAT_S24_MAX));
+
+	float_to_s24_from(dst, src, offset, samples);
+}
+
+__attribute__((target("sse2")))
+static void
+sndmix_float_to_s32_sse2(int32_t *dst, const float *src,
+                         unsigned int samples)
+{
+	unsigned int offset;
+
+	for (offset = 0; offset + 4 <= samples; offset += 4)
+		_mm_storeu_si128((__m128i*) (dst + offset),
+		                 float_to_int_sse2(_mm_loadu_ps(src + offset),
+		                                   FLOAT_S32_SCALE,
+		                                   FLOAT_S32_MAX));
+
+	float_to_s32_from(dst, src, offset, samples);
+}
+
+/*
+ * Gain segments are vectorized when a vector holds whole
+ * frames. Lanes keep their own gain, incremented by the
+ * frames of a vector each step.
+ */
+
+__attribute__((target("sse2")))
+static void
+segment_float_sse2(void *dst, const void **src, const float *a,
+                   const float *b, unsigned int count, unsigned int frames,
+                   unsigned int channels)
+{
+	const float **s = (const float**) src;
+	float *d = dst;
+	unsigned int samples = frames * channels;
+	float sum[samples];
+	float la[4], lb[4], lf[4];
+	__m128 va, vb, vf, step, acc;
+	unsigned int i, j, k;
+
+	if (4 % channels) {
+		segment_float_generic(dst, src, a, b, count, frames,
+		                      channels);
+		return;
+	}
+
+	for (i = 0; i < samples; i++)
+		sum[i] = 0.0f;
+
+	step = _mm_set1_ps(4 / channels);
+
+	for (j = 0; j < count; j++) {
+		for (k = 0; k < 4; k++) {
+			la[k] = a[j * channels + k % channels];
+			lb[k] = b[j * channels + k % channels];
+			lf[k] = k / channels;
+		}
+		va = _mm_loadu_ps(la);
+		vb = _mm_loadu_ps(lb);
+		vf = _mm_loadu_ps(lf);
+
+		for (i = 0; i + 4 <= samples; i += 4) {
+			acc = _mm_loadu_ps(sum + i);
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(s[j] + i),
+			      _mm_add_ps(va, _mm_mul_ps(vb, vf))));
+			_mm_storeu_ps(sum + i, acc);
+			vf = _mm_add_ps(vf, step);
+		}
+
+		for (; i < samples; i++)
+			sum[i] += s[j][i] * (a[j * channels + i % channels] +
+			          b[j * channels + i % channels] *
+			          (float) (i / channels));
+	}
+
+	for (i = 0; i < samples; i++)
+		d[i] = sum[i];
+}
+
+__attribute__((target("sse2")))
+static void
+segment_16_sse2(void *dst, const void **src, const float *a,
+                const float *b, unsigned int count, unsigned int frames,
+                unsigned int channels)
+{
+	const int16_t **s = (const int16_t**) src;
+	int16_t *d = dst;
+	unsigned int samples = frames * channels;
+	int32_t sum[samples + 8];
+	int32_t aq[channels], bq[channels];
+	int32_t lg[8], ls[8];
+	const __m128i zero = _mm_setzero_si128();
+	__m128i g_lo, g_hi, step_lo, step_hi, g, v;
+	unsigned int i, j, k;
+
+	if (8 % channels) {
+		segment_16_generic(dst, src, a, b, count, frames, channels);
+		return;
+	}
+
+	for (i = 0; i < samples; i++)
+		sum[i] = 0;
+
+	for (j = 0; j < count; j++) {
+		segment_q28(a + j * channels, b + j * channels, frames,
+		            channels, aq, bq);
+
+		/* Q28 gain of each lane and its change per vector */
+		for (k = 0; k < 8; k++) {
+			lg[k] = aq[k % channels] + bq[k % channels] *
+			        (int32_t) (k / channels);
+			ls[k] = bq[k % channels] * (int32_t) (8 / channels);
+		}
+		g_lo = _mm_loadu_si128((__m128i*) lg);
+		g_hi = _mm_loadu_si128((__m128i*) (lg + 4));
+		step_lo = _mm_loadu_si128((__m128i*) ls);
+		step_hi = _mm_loadu_si128((__m128i*) (ls + 4));
+
+		for (i = 0; i + 8 <= samples; i += 8) {
+			/* Q14 gain, then sample * gain >> 14 */
+			g = _mm_packs_epi32(_mm_srai_epi32(g_lo, 14),
+			                    _mm_srai_epi32(g_hi, 14));
+			v = _mm_loadu_si128((__m128i*) (s[j] + i));
+
+			_mm_storeu_si128((__m128i*) (sum + i), _mm_add_epi32(
+			        _mm_loadu_si128((__m128i*) (sum + i)),
+			        _mm_srai_epi32(_mm_madd_epi16(
+			        _mm_unpacklo_epi16(v, zero),
+			        _mm_unpacklo_epi16(g, zero)), 14)));
+			_mm_storeu_si128((__m128i*) (sum + i + 4),
+			        _mm_add_epi32(
+			        _mm_loadu_si128((__m128i*) (sum + i + 4)),
+			        _mm_srai_epi32(_mm_madd_epi16(
+			        _mm_unpackhi_epi16(v, zero),
+			        _mm_unpackhi_epi16(g, zero)), 14)));
+
+			g_lo = _mm_add_epi32(g_lo, step_lo);
+			g_hi = _mm_add_epi32(g_hi, step_hi);
+		}
+
+		for (; i < samples; i++)
+			sum[i] += (s[j][i] * ((aq[i % channels] +
+			           bq[i % channels] *
+			           (int32_t) (i / channels)) >> 14)) >> 14;
+	}
+
+	for (i = 0; i + 8 <= samples; i += 8)
+		_mm_storeu_si128((__m128i*) (d + i), _mm_packs_epi32(
+		                 _mm_loadu_si128((__m128i*) (sum + i)),
+		                 _mm_loadu_si128((__m128i*) (sum + i + 4))));
+	for (; i < samples; i++) {
+		if (sum[i] > INT16_MAX)
+			d[i] = INT16_MAX;
+		else if (sum[i] < INT16_MIN)
+			d[i] = INT16_MIN;
+		else
+			d[i] = sum[i];
+	}
+}
+
+/*
+ * Dither is drawn for 8 samples at once (two draws of
+ * the 4 generators), added while converting.
+ */
+__attribute__((target("sse2")))
+static inline __m128
+tpdf_sse2(__m128i *state)
+{
+	const __m128i low = _mm_set1_epi32(0xffff);
+	__m128i x = *state;
+
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	*state = x;
+
+	x = _mm_add_epi32(_mm_and_si128(x, low), _mm_srli_epi32(x, 16));
+	x = _mm_sub_epi32(x, _mm_set1_epi32(65535));
+
+	return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / 65536));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+dither_sse2(__m128 sample, __m128 noise)
+{
+	sample = _mm_mul_ps(sample, _mm_set1_ps(FLOAT_S16_SCALE));
+	sample = _mm_add_ps(sample, noise);
+	sample = _mm_min_ps(sample, _mm_set1_ps(FLOAT_S16_MAX));
+	sample = _mm_max_ps(sample, _mm_set1_ps(-FLOAT_S16_SCALE));
+	return _mm_cvtps_epi32(sample);
+}
+
+__attribute__((target("sse2")))
+static void
+sndmix_float_to_s16_dither_sse2(int16_t *dst, const float *src,
+                                unsigned int samples,
+                                struct sndmix_dither *d)
+{
+	__m128i state, lo, hi;
+	unsigned int offset;
+
+	if (d->shaping) {
+		dither_shaped(dst, src, samples, d);
+		return;
+	}
+
+	state = _mm_loadu_si128((__m128i*) d->state);
+
+	for (offset = 0; offset + 8 <= samples; offset += 8) {
+		lo = dither_sse2(_mm_loadu_ps(src + offset), tpdf_sse2(&state));
+		hi = dither_sse2(_mm_loadu_ps(src + offset + 4),
+		                 tpdf_sse2(&state));
+		_mm_storeu_si128((__m128i*) (dst + offset),
+		                 _mm_packs_epi32(lo, hi));
+	}
+
+	_mm_storeu_si128((__m128i*) d->state, state);
+
+	dither_from(dst, src, offset, samples, d);
+}
+
+#endif /* MIX_X86 */
+
+/*
+ * ARM
+ * ===
+ *
+ * NEON is selected at build time, it's either available
+ * or not for the whole binary.
+ */
+
+#ifdef MIX_NEON
+
+static void
+sndmix_n_16_neon(int16_t *dst, const int16_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	int16x8_t s0, s1;
+	int32x4_t sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 16 <= samples; offset += 16) {
+		sum0 = sum1 = sum2 = sum3 = vdupq_n_s32(0);
+
+		for (j = 0; j < count; j++) {
+			s0 = vld1q_s16(src[j] + offset);
+			s1 = vld1q_s16(src[j] + offset + 8);
+
+			sum0 = vaddw_s16(sum0, vget_low_s16(s0));
+			sum1 = vaddw_s16(sum1, vget_high_s16(s0));
+			sum2 = vaddw_s16(sum2, vget_low_s16(s1));
+			sum3 = vaddw_s16(sum3, vget_high_s16(s1));
+		}
+
+		vst1q_s16(dst + offset, vcombine_s16(vqmovn_s32(sum0),
+		                                     vqmovn_s32(sum1)));
+		vst1q_s16(dst + offset + 8, vcombine_s16(vqmovn_s32(sum2),
+		                                         vqmovn_s32(sum3)));
+	}
+
+	mix_16_from(dst, src, count, offset, samples);
+}
+
+static void
+sndmix_n_32_neon(int32_t *dst, const int32_t **src, unsigned int count,
+                 unsigned int samples)
+{
+	int32x4_t s;
+	int64x2_t sum0, sum1;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 4 <= samples; offset += 4) {
+		sum0 = sum1 = vdupq_n_s64(0);
+
+		for (j = 0; j < count; j++) {
+			s = vld1q_s32(src[j] + offset);
+			sum0 = vaddw_s32(sum0, vget_low_s32(s));
+			sum1 = vaddw_s32(sum1, vget_high_s32(s));
+		}
+
+		vst1q_s32(dst + offset, vcombine_s32(vqmovn_s64(sum0),
+		                                     vqmovn_s64(sum1)));
+	}
+
+	mix_32_from(dst, src, count, offset, samples);
+}
+
+static void
+sndmix_n_float_neon(float *dst, const float **src, unsigned int count,
+                    unsigned int samples)
+{
+	float32x4_t sum0, sum1, sum2, sum3;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 16 <= samples; offset += 16) {
+		sum0 = sum1 = sum2 = sum3 = vdupq_n_f32(0.0f);
+
+		for (j = 0; j < count; j++) {
+			sum0 = vaddq_f32(sum0, vld1q_f32(src[j] + offset));
+			sum1 = vaddq_f32(sum1, vld1q_f32(src[j] + offset + 4));
+			sum2 = vaddq_f32(sum2, vld1q_f32(src[j] + offset + 8));
+			sum3 = vaddq_f32(sum3, vld1q_f32(src[j] + offset + 12));
+		}
+
+		vst1q_f32(dst + offset, sum0);
+		vst1q_f32(dst + offset + 4, sum1);
+		vst1q_f32(dst + offset + 8, sum2);
+		vst1q_f32(dst + offset + 12, sum3);
+	}
+
+	mix_float_from(dst, src, count, offset, samples);
+}
+
+static void
+sndmix_n_s24_neon(int32_t *dst, const int32_t **src, unsigned int count,
+                  unsigned int samples)
+{
+	const int32x4_t max = vdupq_n_s32(S24_MAX);
+	const int32x4_t min = vdupq_n_s32(S24_MIN);
+	int32x4_t sum0, sum1;
+	unsigned int offset;
+	unsigned int j;
+
+	for (offset = 0; offset + 8 <= samples; offset += 8) {
+		sum0 = sum1 = vdupq_n_s32(0);
+
+		for (j = 0; j < count; j++) {
+			sum0 = vaddq_s32(sum0, vshrq_n_s32(vshlq_n_s32(
+			       vld1q_s32(src[j] + offset), 8), 8));
+			sum1 = vaddq_s32(sum1, vshrq_n_s32(vshlq_n_s32(
+			       vld1q_s32(src[j] + offset + 4), 8), 8));
+		}
+
+		vst1q_s32(dst + offset, vmaxq_s32(vminq_s32(sum0, max), min));
+		vst1q_s32(dst + offset + 4,
+		          vmaxq_s32(vminq_s32(sum1, max), min));
+	}
+
+	mix_s24_from(dst, src, count, offset, samples);
+}
+
+#endif /* MIX_NEON */
+
+/*
+ * Dispatch
+ * ========
+ *
+ * The best version of each function for the CPU is
+ * selected once, before main().
+ */
+
+static void (*mix_16) (int16_t*, const int16_t**, unsigned int,
+                       unsigned int) = sndmix_n_16_generic;
+static void (*mix_32) (int32_t*, const int32_t**, unsigned int,
+                       unsigned int) = sndmix_n_32_generic;
+static void (*mix_s24) (int32_t*, const int32_t**, unsigned int,
+                        unsigned int) = sndmix_n_s24_generic;
+static void (*mix_float) (float*, const float**, unsigned int,
+                          unsigned int) = sndmix_n_float_generic;
+static segment_t segment_16 = segment_16_generic;
+static segment_t segment_float = segment_float_generic;
+static void (*to_s16) (int16_t*, const float*, unsigned int) =
+	sndmix_float_to_s16_generic;
+static void (*to_s24) (int32_t*, const float*, unsigned int) =
+	sndmix_float_to_s24_generic;
+static void (*to_s32) (int32_t*, const float*, unsigned int) =
+	sndmix_float_to_s32_generic;
+static void (*to_s16_dither) (int16_t*, const float*, unsigned int,
+                              struct sndmix_dither*) =
+	sndmix_float_to_s16_dither_generic;
+
+/*
+ * select the best versions up to instruction set 'isa'
+ * (SNDMIX_ISA_*), for testing and benchmarking
+ *
+ * Return the instruction set selected, lower than 'isa'
+ * if the CPU doesn't support it.
+ */
+unsigned int
+sndmix_select(unsigned int isa)
+{
+	unsigned int selected = SNDMIX_ISA_GENERIC;
+
+	mix_16 = sndmix_n_16_generic;
+	mix_32 = sndmix_n_32_generic;
+	mix_s24 = sndmix_n_s24_generic;
+	mix_float = sndmix_n_float_generic;
+	segment_16 = segment_16_generic;
+	segment_float = segment_float_generic;
+	to_s16 = sndmix_float_to_s16_generic;
+	to_s24 = sndmix_float_to_s24_generic;
+	to_s32 = sndmix_float_to_s32_generic;
+	to_s16_dither = sndmix_float_to_s16_dither_generic;
+
+#if defined(MIX_X86)
+	__builtin_cpu_init();
+	if (isa >= SNDMIX_ISA_SSE2 && __builtin_cpu_supports("sse2")) {
+		mix_16 = sndmix_n_16_sse2;
+		mix_float = sndmix_n_float_sse2;
+		segment_16 = segment_16_sse2;
+		segment_float = segment_float_sse2;
+		to_s16 = sndmix_float_to_s16_sse2;
+		to_s24 = sndmix_float_to_s24_sse2;
+		to_s32 = sndmix_float_to_s32_sse2;
+		to_s16_dither = sndmix_float_to_s16_dither_sse2;
+		selected = SNDMIX_ISA_SSE2;
+	}
+	if (isa >= SNDMIX_ISA_AVX && __builtin_cpu_supports("avx")) {
+		mix_float = sndmix_n_float_avx;
+		selected = SNDMIX_ISA_AVX;
+	}
+	if (isa >= SNDMIX_ISA_AVX2 && __builtin_cpu_supports("avx2")) {
+		mix_16 = sndmix_n_16_avx2;
+		mix_32 = sndmix_n_32_avx2;
+		mix_s24 = sndmix_n_s24_avx2;
+		selected = SNDMIX_ISA_AVX2;
+	}
+#elif defined(MIX_NEON)
+	if (isa >= SNDMIX_ISA_NEON) {
+		mix_16 = sndmix_n_16_neon;
+		mix_32 = sndmix_n_32_neon;
+		mix_s24 = sndmix_n_s24_neon;
+		mix_float = sndmix_n_float_neon;
+		selected = SNDMIX_ISA_NEON;
+	}
+#endif
+
+	return selected;
+}
+
+__attribute__((constructor))
+static void
+select_functions(void)
+{
+	sndmix_select(SNDMIX_ISA_BEST);
+}
+
+void
+sndmix_n_16(int16_t *dst, const int16_t **src, unsigned int count,
+            unsigned int samples)
+{
+	mix_16(dst, src, count, samples);
+}
+
+void
+sndmix_n_32(int32_t *dst, const int32_t **src, unsigned int count,
+            unsigned int samples)
+{
+	mix_32(dst, src, count, samples);
+}
+
+void
+sndmix_n_s24(int32_t *dst, const int32_t **src, unsigned int count,
+             unsigned int samples)
+{
+	if (count > S24_VECTOR_SOURCES)
+		sndmix_n_s24_generic(dst, src, count, samples);
+	else
+		mix_s24(dst, src, count, samples);
+}
+
+void
+sndmix_n_float(float *dst, const float **src, unsigned int count,
+               unsigned int samples)
+{
+	mix_float(dst, src, count, samples);
+}
+
+void
+sndmix_n_16_gain(int16_t *dst, const int16_t **src, struct sndmix_gain **gains,
+                 unsigned int count, unsigned int frames,
+                 unsigned int channels)
+{
+	mix_gain(dst, (const void**) src, gains, count, frames, channels,
+	         sizeof(*dst), segment_16);
+}
+
+void
+sndmix_n_float_gain(float *dst, const float **src, struct sndmix_gain **gains,
+                    unsigned int count, unsigned int frames,
+                    unsigned int channels)
+{
+	mix_gain(dst, (const void**) src, gains, count, frames, channels,
+	         sizeof(*dst), segment_float);
+}
+
+void
+sndmix_float_to_s16_dither(int16_t *dst, const float *src,
+                           unsigned int samples, struct sndmix_dither *d)
+{
+	to_s16_dither(dst, src, samples, d);
+}
+
+void
+sndmix_float_to_s16(int16_t *dst, const float *src, unsigned int samples)
+{
+	to_s16(dst, src, samples);
+}
+
+void
+sndmix_float_to_s24(int32_t *dst, const float *src, unsigned int samples)
+{
+	to_s24(dst, src, samples);
+}
+
+void
+sndmix_float_to_s32(int32_t *dst, const float *src, unsigned int samples)
+{
+	to_s32(dst, src, samples);
+}
@@ -19,19 +19,254 @@
 #ifndef SOUND_MIX_UTILITY_H
 #define SOUND_MIX_UTILITY_H
 
+#include <stdint.h> /* int*_t */
+
+#include "sound_parameters.h" /* SND_FORMAT_* */
+
+/*
+ * Mix 'count' sources of 'samples' samples into dst,
+ * saturating the sum. With no source, dst is silence.
+ *
+ * - s24: S24_LE, 24-bit samples in the low bits of 32-bit
+ *   containers. Vector versions take up to 256 sources,
+ *   more are mixed by the scalar version.
+ * - s24_3le: S24_3LE, packed 3-byte samples.
+ * - float: FLOAT_LE, not saturated. Full scale is
+ *   [-1.0, 1.0), see sndmix_float_to_*().
+ *
+ * Use the fastest version for the CPU (SSE2, AVX, AVX2 or
+ * NEON), all of them give the same output as the
+ * scalar *_generic() versions. sndmix_select() limits
+ * the versions used, see tools/test/mix_test.c.
+ */
+
+#define SNDMIX_ISA_GENERIC  0
+#define SNDMIX_ISA_SSE2     1
+#define SNDMIX_ISA_NEON     1 /* ARM has no level above */
+#define SNDMIX_ISA_AVX      2
+#define SNDMIX_ISA_AVX2     3
+#define SNDMIX_ISA_BEST     3
+
+unsigned int
+sndmix_select(unsigned int isa);
+
+void
+sndmix_n_16(int16_t *dst, const int16_t **src, unsigned int count,
+            unsigned int samples);
+
+void
+sndmix_n_32(int32_t *dst, const int32_t **src, unsigned int count,
+            unsigned int samples);
+
+void
+sndmix_n_s24(int32_t *dst, const int32_t **src, unsigned int count,
+             unsigned int samples);
+
+void
+sndmix_n_s24_3le(uint8_t *dst, const uint8_t **src, unsigned int count,
+                 unsigned int samples);
+
+void
+sndmix_n_float(float *dst, const float **src, unsigned int count,
+               unsigned int samples);
+
+void
+sndmix_n_16_generic(int16_t *dst, const int16_t **src, unsigned int count,
+                    unsigned int samples);
+
+void
+sndmix_n_32_generic(int32_t *dst, const int32_t **src, unsigned int count,
+                    unsigned int samples);
+
+void
+sndmix_n_s24_generic(int32_t *dst, const int32_t **src, unsigned int count,
+                     unsigned int samples);
+
+void
+sndmix_n_float_generic(float *dst, const float **src, unsigned int count,
+                       unsigned int samples);
+
+/*
+ * convert a float mix to the sound device format,
+ * clamping to full scale and rounding to nearest
+ */
+
+void
+sndmix_float_to_s16(int16_t *dst, const float *src, unsigned int samples);
+
+void
+sndmix_float_to_s24(int32_t *dst, const float *src, unsigned int samples);
+
+void
+sndmix_float_to_s24_3le(uint8_t *dst, const float *src, unsigned int samples);
+
+void
+sndmix_float_to_s32(int32_t *dst, const float *src, unsigned int samples);
+
+void
+sndmix_float_to_s16_generic(int16_t *dst, const float *src,
+                            unsigned int samples);
+
+void
+sndmix_float_to_s24_generic(int32_t *dst, const float *src,
+                            unsigned int samples);
+
+void
+sndmix_float_to_s32_generic(int32_t *dst, const float *src,
+                            unsigned int samples);
+
+/*
+ * Dither
+ * ======
+ *
+ * Convert a float mix to 16-bit adding TPDF dither, and
+ * optionally first-order noise shaping (scalar only). A
+ * state is used by a single thread at a time and keeps
+ * the random generators and the error of each channel
+ * between calls. Shaping is left off unless channels is
+ * 1 to SNDMIX_DITHER_CHANNELS.
+ */
+
+#define SNDMIX_DITHER_LANES     4
+#define SNDMIX_DITHER_CHANNELS  8 /* maximum for noise shaping */
+
+struct sndmix_dither {
+	uint32_t state[SNDMIX_DITHER_LANES];
+	unsigned int channels;
+	int shaping;
+	float error[SNDMIX_DITHER_CHANNELS];
+};
+
+void
+sndmix_dither_init(struct sndmix_dither *d, unsigned int channels,
+                   int shaping, uint32_t seed);
+
+void
+sndmix_float_to_s16_dither(int16_t *dst, const float *src,
+                           unsigned int samples, struct sndmix_dither *d);
+
 void
-sndmix_16(int16_t *dst, int16_t *src, int32_t *sum, unsigned int samples);
+sndmix_float_to_s16_dither_generic(int16_t *dst, const float *src,
+                                   unsigned int samples,
+                                   struct sndmix_dither *d);
+
+/*
+ * Gain and pan of a voice
+ * =======================
+ *
+ * gain, pan and ramp may be changed at any time, they
+ * are read once per mix. The mix ramps from the gain of
+ * the previous mix to the new one in a period, without
+ * clicks.
+ *
+ * Pan is constant power and applies to stereo only. For
+ * 16-bit, gain is in fixed point and goes from -2.0 to
+ * almost 2.0 (+6 dB). Negative gains invert polarity,
+ * exponential ramps between gains of opposite sign are
+ * linear.
+ *
+ * Gain is applied to S16 and float mixes only. Mix other
+ * formats in float and convert (sndmix_float_to()).
+ */
+
+#define SNDMIX_GAIN_CHANNELS  2
+
+#define SNDMIX_RAMP_LINEAR  0
+#define SNDMIX_RAMP_EXP     1 /* constant dB per frame */
+
+struct sndmix_gain {
+	float gain;
+	float pan; /* -1.0 (left) to 1.0 (right) */
+	int ramp;
+
+	/* gain of each channel at the end of previous mix */
+	float current[SNDMIX_GAIN_CHANNELS];
+};
 
 void
-sndmix_32(int32_t *dst, int32_t *src, int64_t *sum, unsigned int samples);
+sndmix_gain_init(struct sndmix_gain *g, float gain, float pan, int ramp,
+                 unsigned int channels);
 
-static inline void
-sndmix(void *dst, void *src, void *sum, unsigned int samples, unsigned int bits)
+/*
+ * like sndmix_n_16() and sndmix_n_float(), with gain and
+ * pan of each source applied while summing
+ */
+
+void
+sndmix_n_16_gain(int16_t *dst, const int16_t **src, struct sndmix_gain **gains,
+                 unsigned int count, unsigned int frames,
+                 unsigned int channels);
+
+void
+sndmix_n_float_gain(float *dst, const float **src, struct sndmix_gain **gains,
+                    unsigned int count, unsigned int frames,
+                    unsigned int channels);
+
+void
+sndmix_n_16_gain_generic(int16_t *dst, const int16_t **src,
+                         struct sndmix_gain **gains, unsigned int count,
+                         unsigned int frames, unsigned int channels);
+
+void
+sndmix_n_float_gain_generic(float *dst, const float **src,
+                            struct sndmix_gain **gains, unsigned int count,
+                            unsigned int frames, unsigned int channels);
+
+/*
+ * mix samples of a sound device format
+ *
+ * Return -1 if format is not supported.
+ */
+static inline int
+sndmix_n(void *dst, const void **src, unsigned int count,
+         unsigned int samples, unsigned int format)
+{
+	switch (format) {
+	case SND_FORMAT_S16_LE:
+		sndmix_n_16(dst, (const int16_t**) src, count, samples);
+		return 0;
+	case SND_FORMAT_S32_LE:
+		sndmix_n_32(dst, (const int32_t**) src, count, samples);
+		return 0;
+	case SND_FORMAT_S24_LE:
+		sndmix_n_s24(dst, (const int32_t**) src, count, samples);
+		return 0;
+	case SND_FORMAT_S24_3LE:
+		sndmix_n_s24_3le(dst, (const uint8_t**) src, count, samples);
+		return 0;
+	case SND_FORMAT_FLOAT_LE:
+		sndmix_n_float(dst, (const float**) src, count, samples);
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * convert a float mix to a sound device format
+ *
+ * Return -1 if format is not supported.
+ */
+static inline int
+sndmix_float_to(void *dst, const float *src, unsigned int samples,
+                unsigned int format)
 {
-	if (bits == 16)
-		sndmix_16(dst, src, sum, samples);
-	else if (bits == 32)
-		sndmix_32(dst, src, sum, samples);
+	switch (format) {
+	case SND_FORMAT_S16_LE:
+		sndmix_float_to_s16(dst, src, samples);
+		return 0;
+	case SND_FORMAT_S32_LE:
+		sndmix_float_to_s32(dst, src, samples);
+		return 0;
+	case SND_FORMAT_S24_LE:
+		sndmix_float_to_s24(dst, src, samples);
+		return 0;
+	case SND_FORMAT_S24_3LE:
+		sndmix_float_to_s24_3le(dst, src, samples);
+		return 0;
+	}
+
+	return -1;
 }
 
 #endif /* SOUND_MIX_UTILITY_H */
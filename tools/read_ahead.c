@@ -0,0 +1,157 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read a memory mapped file ahead in a thread
+ *
+ * Page faults of a slow disk or a cold page cache block
+ * the reader thread, not the real-time loop. The
+ * real-time loop takes a buffer only if it's ready.
+ *
+ * Single producer (reader thread), single consumer. head
+ * and tail count buffers filled and consumed, each one
+ * is written by one side only.
+ */
+
+#include <errno.h>     /* EINTR */
+#include <pthread.h>   /* pthread_*() */
+#include <semaphore.h> /* sem_*() */
+#include <stdlib.h>    /* malloc(), free() */
+#include <string.h>    /* memcpy(), memset() */
+
+#include "read_ahead.h"
+
+static void *
+reader(void *arg)
+{
+	struct read_ahead *ra = arg;
+	unsigned long head = ra->head;
+	unsigned int i;
+	size_t tmp;
+
+	while (!ra->stop) {
+		if (sem_wait(&ra->free) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (ra->stop)
+			break;
+
+		i = head % ra->count;
+
+		tmp = ra->length - ra->offset;
+		if (tmp > ra->size)
+			tmp = ra->size;
+
+		memcpy(ra->buffers + i * ra->size, ra->src + ra->offset, tmp);
+		/* a short buffer is padded with silence */
+		memset(ra->buffers + i * ra->size + tmp, 0, ra->size - tmp);
+
+		ra->bytes[i] = tmp;
+		ra->offset += tmp;
+
+		/* publish the buffer after it's filled */
+		__atomic_store_n(&ra->head, ++head, __ATOMIC_RELEASE);
+
+		/* end of file */
+		if (tmp == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * start reading 'length' bytes from 'src' in 'count'
+ * buffers of 'size' bytes
+ */
+int
+read_ahead_open(struct read_ahead *ra, const void *src, size_t length,
+                size_t size, unsigned int count)
+{
+	ra->src = src;
+	ra->length = length;
+	ra->offset = 0;
+	ra->size = size;
+	ra->count = count;
+	ra->head = 0;
+	ra->tail = 0;
+	ra->stop = 0;
+
+	ra->buffers = malloc(size * count);
+	ra->bytes = calloc(count, sizeof(*ra->bytes));
+	if (!ra->buffers || !ra->bytes)
+		goto _go_free;
+
+	if (sem_init(&ra->free, 0, count) == -1)
+		goto _go_free;
+
+	if (pthread_create(&ra->thread, NULL, reader, ra) != 0)
+		goto _go_sem_destroy;
+
+	return 0;
+
+_go_sem_destroy:
+	sem_destroy(&ra->free);
+_go_free:
+	free(ra->bytes);
+	free(ra->buffers);
+	return -1;
+}
+
+void
+read_ahead_close(struct read_ahead *ra)
+{
+	ra->stop = 1;
+	sem_post(&ra->free);
+	pthread_join(ra->thread, NULL);
+
+	sem_destroy(&ra->free);
+	free(ra->bytes);
+	free(ra->buffers);
+}
+
+/*
+ * get the next buffer, if ready
+ *
+ * Return NULL if reader is late. Otherwise, *bytes is
+ * set to the bytes in buffer (zero at end of file) and
+ * read_ahead_put() must be called when done with it.
+ */
+const void *
+read_ahead_get(struct read_ahead *ra, size_t *bytes)
+{
+	unsigned int i;
+
+	if (__atomic_load_n(&ra->head, __ATOMIC_ACQUIRE) == ra->tail)
+		return NULL;
+
+	i = ra->tail % ra->count;
+	*bytes = ra->bytes[i];
+
+	return ra->buffers + i * ra->size;
+}
+
+/* give the buffer from read_ahead_get() back to reader */
+void
+read_ahead_put(struct read_ahead *ra)
+{
+	ra->tail++;
+	sem_post(&ra->free);
+}
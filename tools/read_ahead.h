@@ -0,0 +1,69 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <pthread.h>   /* pthread_t */
+#include <semaphore.h> /* sem_t */
+#include <stddef.h>    /* size_t */
+
+/*
+ * A ring of 'count' buffers of 'size' bytes filled by a
+ * reader thread from a memory mapped file (the last one
+ * is padded with zeros). The consumer
+ * (real-time loop) only takes buffers that are ready, it
+ * never blocks.
+ */
+struct read_ahead {
+	/* mapped data, its length, and bytes already read */
+	const char *src;
+	size_t length;
+	size_t offset;
+
+	char *buffers;
+	/* bytes read in each buffer, zero means end of file */
+	size_t *bytes;
+	size_t size;
+	unsigned int count;
+
+	/* buffers filled (reader) and consumed (consumer) */
+	unsigned long head;
+	unsigned long tail;
+
+	/* free buffers, the reader waits on it */
+	sem_t free;
+
+	volatile int stop;
+	pthread_t thread;
+};
+
+int
+read_ahead_open(struct read_ahead *ra, const void *src, size_t length,
+                size_t size, unsigned int count);
+
+void
+read_ahead_close(struct read_ahead *ra);
+
+const void *
+read_ahead_get(struct read_ahead *ra, size_t *bytes);
+
+void
+read_ahead_put(struct read_ahead *ra);
+
+#endif /* READ_AHEAD_H */
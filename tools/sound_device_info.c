@@ -93,6 +93,12 @@ print_parameters(struct snd_parameters *p)
 	       snd_params_test(p, SND_ACCESS, SND_ACCESS_MMAP)
 	       ? "Yes" : "No");
 
+	printf("Non-interleaved access: MMAP %s, RW %s\n",
+	       snd_params_test(p, SND_ACCESS, SND_ACCESS_MMAP_NONINTERLEAVED)
+	       ? "Yes" : "No",
+	       snd_params_test(p, SND_ACCESS, SND_ACCESS_RW_NONINTERLEAVED)
+	       ? "Yes" : "No");
+
 	printf("Sample bits: ");
 	print_range(p, SND_SAMPLE_BITS);
 
@@ -0,0 +1,978 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare the vectorized mix, gain, float conversion and
+ * dither functions with the scalar *_generic() versions
+ *
+ * Each instruction set the CPU supports is selected in
+ * turn (sndmix_select()). The output must be bit-exact,
+ * for random inputs, lengths that don't fill a vector
+ * and pointers not aligned to a vector. Integer mixes of
+ * up to MAX_SOURCES sources are also checked against a
+ * plain saturated sum.
+ *
+ * The limiter and the compressor of mix_dynamics.h are
+ * checked against what they promise: ceiling, delay and
+ * static curve.
+ *
+ * Exit status is 1 if any output differs.
+ */
+
+#include <math.h>   /* fabsf(), log10f(), powf(), sinf(), M_PI */
+#include <stdint.h> /* int*_t, uint*_t */
+#include <stdio.h>  /* printf() */
+#include <stdlib.h> /* aligned_alloc(), free() */
+#include <string.h> /* memcmp(), memset() */
+
+#include "mix_dynamics.h"
+#include "mix_utility.h"
+
+/* up to MAX_SOURCES sources of MAX_SAMPLES samples */
+#define MAX_SOURCES  70
+#define MAX_SAMPLES  4099
+
+/* 24-bit mixes take more sources, see test_mix_s24() */
+#define MAX_S24_SOURCES  300
+
+/* misalignment, in samples, of each buffer */
+#define MAX_SHIFT  3
+
+#define ALIGN  64
+
+static const char *isa_names[] = {"generic", "SSE2/NEON", "AVX", "AVX2"};
+
+static const unsigned int lengths[] = {
+	0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 67, 255, 257,
+	1000, MAX_SAMPLES,
+};
+
+static unsigned int checks;
+static unsigned int failures;
+
+/* one buffer per source plus three outputs, MAX_SHIFT spare */
+static char *buffers[MAX_SOURCES + 3];
+
+static uint32_t random_state = 2463534242u;
+
+static uint32_t
+random32(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state;
+}
+
+/*
+ * Random samples. One in eight is at full scale, so sums
+ * saturate often.
+ */
+
+static void
+fill_16(int16_t *dst, unsigned int samples)
+{
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		if (random32() % 8 == 0)
+			dst[i] = random32() & 1 ? INT16_MAX : INT16_MIN;
+		else
+			dst[i] = random32();
+	}
+}
+
+static void
+fill_32(int32_t *dst, unsigned int samples)
+{
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		if (random32() % 8 == 0)
+			dst[i] = random32() & 1 ? INT32_MAX : INT32_MIN;
+		else
+			dst[i] = random32();
+	}
+}
+
+static void
+fill_float(float *dst, unsigned int samples)
+{
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		if (random32() % 8 == 0)
+			dst[i] = random32() & 1 ? 1.0f : -1.0f;
+		else
+			dst[i] = (int32_t) random32() / 2147483648.0f;
+	}
+}
+
+/* 24-bit samples with garbage in the unused high byte */
+static void
+fill_s24(int32_t *dst, unsigned int samples)
+{
+	unsigned int i;
+	int32_t sample;
+
+	for (i = 0; i < samples; i++) {
+		if (random32() % 8 == 0)
+			sample = random32() & 1 ? 8388607 : -8388608;
+		else
+			sample = random32();
+		dst[i] = (sample & 0xffffff) | random32() << 24;
+	}
+}
+
+static void
+fill_bytes(uint8_t *dst, unsigned int bytes)
+{
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++)
+		dst[i] = random32();
+}
+
+/*
+ * Floats to convert: beyond full scale, exactly at it and
+ * halfway between two integers (rounding)
+ */
+static void
+fill_float_wide(float *dst, unsigned int samples)
+{
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		switch (random32() % 8) {
+		case 0:
+			dst[i] = random32() & 1 ? 1.0f : -1.0f;
+			break;
+		case 1:
+			dst[i] = ((int32_t) (random32() % 65536) - 32768 +
+			          0.5f) / 32768.0f;
+			break;
+		default:
+			dst[i] = (int32_t) random32() / 1431655765.0f;
+			break;
+		}
+	}
+}
+
+/* report a mismatch between output a and b */
+static void
+check(const char *name, unsigned int isa, const void *a, const void *b,
+      size_t bytes, unsigned int count, unsigned int samples,
+      unsigned int shift)
+{
+	checks++;
+	if (memcmp(a, b, bytes) == 0)
+		return;
+
+	failures++;
+	printf("FAIL %s (%s): %u sources, %u samples, shifted %u\n",
+	       name, isa_names[isa], count, samples, shift);
+}
+
+/*
+ * Mix
+ * ===
+ */
+
+/*
+ * plain sum of all sources, saturated per sample, as the
+ * mix must give no matter how it accumulates
+ */
+
+static void
+reference_16(int16_t *dst, const int16_t **src, unsigned int count,
+             unsigned int samples)
+{
+	unsigned int i, j;
+	int64_t sum;
+
+	for (i = 0; i < samples; i++) {
+		sum = 0;
+		for (j = 0; j < count; j++)
+			sum += src[j][i];
+
+		if (sum > INT16_MAX)
+			sum = INT16_MAX;
+		else if (sum < INT16_MIN)
+			sum = INT16_MIN;
+		dst[i] = sum;
+	}
+}
+
+static void
+reference_32(int32_t *dst, const int32_t **src, unsigned int count,
+             unsigned int samples)
+{
+	unsigned int i, j;
+	int64_t sum;
+
+	for (i = 0; i < samples; i++) {
+		sum = 0;
+		for (j = 0; j < count; j++)
+			sum += src[j][i];
+
+		if (sum > INT32_MAX)
+			sum = INT32_MAX;
+		else if (sum < INT32_MIN)
+			sum = INT32_MIN;
+		dst[i] = sum;
+	}
+}
+
+static int32_t
+s24_load(int32_t sample)
+{
+	return (int32_t) ((uint32_t) sample << 8) >> 8;
+}
+
+static int32_t
+s24_clamp(int64_t sum)
+{
+	if (sum > 8388607)
+		return 8388607;
+	if (sum < -8388608)
+		return -8388608;
+	return sum;
+}
+
+static void
+reference_s24(int32_t *dst, const int32_t **src, unsigned int count,
+              unsigned int samples)
+{
+	unsigned int i, j;
+	int64_t sum;
+
+	for (i = 0; i < samples; i++) {
+		sum = 0;
+		for (j = 0; j < count; j++)
+			sum += s24_load(src[j][i]);
+		dst[i] = s24_clamp(sum);
+	}
+}
+
+static void
+reference_s24_3le(uint8_t *dst, const uint8_t **src, unsigned int count,
+                  unsigned int samples)
+{
+	const uint8_t *p;
+	unsigned int i, j;
+	int32_t sample;
+	int64_t sum;
+
+	for (i = 0; i < samples; i++) {
+		sum = 0;
+		for (j = 0; j < count; j++) {
+			p = src[j] + i * 3;
+			sum += s24_load(p[0] | p[1] << 8 | p[2] << 16);
+		}
+
+		sample = s24_clamp(sum);
+		dst[i * 3] = sample;
+		dst[i * 3 + 1] = sample >> 8;
+		dst[i * 3 + 2] = sample >> 16;
+	}
+}
+
+static void
+test_mix_16(unsigned int isa, unsigned int count, unsigned int samples,
+            unsigned int shift)
+{
+	const int16_t *src[MAX_SOURCES];
+	int16_t *a = (int16_t*) buffers[MAX_SOURCES] + shift;
+	int16_t *b = (int16_t*) buffers[MAX_SOURCES + 1] + shift;
+	int16_t *r = (int16_t*) buffers[MAX_SOURCES + 2] + shift;
+	unsigned int j;
+
+	for (j = 0; j < count; j++) {
+		src[j] = (int16_t*) buffers[j] + (shift + j) % (MAX_SHIFT + 1);
+		fill_16((int16_t*) src[j], samples);
+	}
+
+	sndmix_n_16(a, src, count, samples);
+	sndmix_n_16_generic(b, src, count, samples);
+	check("sndmix_n_16", isa, a, b, samples * sizeof(*a), count,
+	      samples, shift);
+
+	reference_16(r, src, count, samples);
+	check("sndmix_n_16_generic", 0, b, r, samples * sizeof(*a), count,
+	      samples, shift);
+}
+
+static void
+test_mix_32(unsigned int isa, unsigned int count, unsigned int samples,
+            unsigned int shift)
+{
+	const int32_t *src[MAX_SOURCES];
+	int32_t *a = (int32_t*) buffers[MAX_SOURCES] + shift;
+	int32_t *b = (int32_t*) buffers[MAX_SOURCES + 1] + shift;
+	int32_t *r = (int32_t*) buffers[MAX_SOURCES + 2] + shift;
+	unsigned int j;
+
+	for (j = 0; j < count; j++) {
+		src[j] = (int32_t*) buffers[j] + (shift + j) % (MAX_SHIFT + 1);
+		fill_32((int32_t*) src[j], samples);
+	}
+
+	sndmix_n_32(a, src, count, samples);
+	sndmix_n_32_generic(b, src, count, samples);
+	check("sndmix_n_32", isa, a, b, samples * sizeof(*a), count,
+	      samples, shift);
+
+	reference_32(r, src, count, samples);
+	check("sndmix_n_32_generic", 0, b, r, samples * sizeof(*a), count,
+	      samples, shift);
+}
+
+static void
+test_mix_float(unsigned int isa, unsigned int count, unsigned int samples,
+               unsigned int shift)
+{
+	const float *src[MAX_SOURCES];
+	float *a = (float*) buffers[MAX_SOURCES] + shift;
+	float *b = (float*) buffers[MAX_SOURCES + 1] + shift;
+	unsigned int j;
+
+	for (j = 0; j < count; j++) {
+		src[j] = (float*) buffers[j] + (shift + j) % (MAX_SHIFT + 1);
+		fill_float((float*) src[j], samples);
+	}
+
+	sndmix_n_float(a, src, count, samples);
+	sndmix_n_float_generic(b, src, count, samples);
+	check("sndmix_n_float", isa, a, b, samples * sizeof(*a), count,
+	      samples, shift);
+}
+
+/*
+ * Sources repeat after MAX_SOURCES, so more than the 256
+ * sources the 24-bit vector versions take can be mixed.
+ * Some samples are at full scale in every source.
+ */
+static void
+test_mix_s24(unsigned int isa, unsigned int count, unsigned int samples,
+             unsigned int shift)
+{
+	const int32_t *src[MAX_S24_SOURCES];
+	int32_t *a = (int32_t*) buffers[MAX_SOURCES] + shift;
+	int32_t *b = (int32_t*) buffers[MAX_SOURCES + 1] + shift;
+	int32_t *r = (int32_t*) buffers[MAX_SOURCES + 2] + shift;
+	unsigned int i, j;
+
+	for (j = 0; j < count; j++) {
+		src[j] = (int32_t*) buffers[j % MAX_SOURCES] +
+		         (shift + j % MAX_SOURCES) % (MAX_SHIFT + 1);
+		if (j < MAX_SOURCES)
+			fill_s24((int32_t*) src[j], samples);
+	}
+
+	/* full scale in all sources, a 32-bit sum would overflow */
+	for (j = 0; j < count && j < MAX_SOURCES; j++) {
+		for (i = 0; i + 3 < samples; i += 4) {
+			((int32_t*) src[j])[i] = 8388607;
+			((int32_t*) src[j])[i + 1] = -8388608;
+		}
+	}
+
+	sndmix_n_s24(a, src, count, samples);
+	sndmix_n_s24_generic(b, src, count, samples);
+	check("sndmix_n_s24", isa, a, b, samples * sizeof(*a), count,
+	      samples, shift);
+
+	reference_s24(r, src, count, samples);
+	check("sndmix_n_s24_generic", 0, b, r, samples * sizeof(*a), count,
+	      samples, shift);
+}
+
+/* packed 24-bit is scalar only, checked against the reference */
+static void
+test_mix_s24_3le(unsigned int count, unsigned int samples,
+                 unsigned int shift)
+{
+	const uint8_t *src[MAX_S24_SOURCES];
+	uint8_t *a = (uint8_t*) buffers[MAX_SOURCES] + shift;
+	uint8_t *r = (uint8_t*) buffers[MAX_SOURCES + 2] + shift;
+	unsigned int j;
+
+	for (j = 0; j < count; j++) {
+		src[j] = (uint8_t*) buffers[j % MAX_SOURCES] +
+		         (shift + j % MAX_SOURCES) % (MAX_SHIFT + 1);
+		if (j < MAX_SOURCES)
+			fill_bytes((uint8_t*) src[j], samples * 3);
+	}
+
+	sndmix_n_s24_3le(a, src, count, samples);
+	reference_s24_3le(r, src, count, samples);
+	check("sndmix_n_s24_3le", 0, a, r, samples * 3, count, samples,
+	      shift);
+}
+
+static void
+test_mix(unsigned int isa)
+{
+	static const unsigned int counts[] = {
+		0, 1, 2, 3, 5, 16, 17, 64, MAX_SOURCES,
+	};
+	static const unsigned int s24_counts[] = {
+		0, 1, 3, 17, 256, 257, MAX_S24_SOURCES,
+	};
+	unsigned int c, l, shift;
+
+	for (c = 0; c < sizeof(counts) / sizeof(*counts); c++) {
+		for (l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+			for (shift = 0; shift <= MAX_SHIFT; shift++) {
+				test_mix_16(isa, counts[c], lengths[l], shift);
+				test_mix_32(isa, counts[c], lengths[l], shift);
+				test_mix_float(isa, counts[c], lengths[l],
+				               shift);
+			}
+		}
+	}
+
+	for (c = 0; c < sizeof(s24_counts) / sizeof(*s24_counts); c++) {
+		for (l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+			for (shift = 0; shift <= MAX_SHIFT; shift++) {
+				test_mix_s24(isa, s24_counts[c], lengths[l],
+				             shift);
+				test_mix_s24_3le(s24_counts[c], lengths[l],
+				                 shift);
+			}
+		}
+	}
+}
+
+/*
+ * Float conversion
+ * ================
+ */
+
+static void
+test_float_to(unsigned int isa, unsigned int samples, unsigned int shift)
+{
+	float *src = (float*) buffers[0] + shift;
+	int16_t *a16 = (int16_t*) buffers[MAX_SOURCES] + shift;
+	int16_t *b16 = (int16_t*) buffers[MAX_SOURCES + 1] + shift;
+	int32_t *a32 = (int32_t*) buffers[MAX_SOURCES] + shift;
+	int32_t *b32 = (int32_t*) buffers[MAX_SOURCES + 1] + shift;
+
+	fill_float_wide(src, samples);
+
+	sndmix_float_to_s16(a16, src, samples);
+	sndmix_float_to_s16_generic(b16, src, samples);
+	check("sndmix_float_to_s16", isa, a16, b16, samples * sizeof(*a16),
+	      1, samples, shift);
+
+	sndmix_float_to_s24(a32, src, samples);
+	sndmix_float_to_s24_generic(b32, src, samples);
+	check("sndmix_float_to_s24", isa, a32, b32, samples * sizeof(*a32),
+	      1, samples, shift);
+
+	sndmix_float_to_s32(a32, src, samples);
+	sndmix_float_to_s32_generic(b32, src, samples);
+	check("sndmix_float_to_s32", isa, a32, b32, samples * sizeof(*a32),
+	      1, samples, shift);
+}
+
+static void
+test_float(unsigned int isa)
+{
+	unsigned int l, shift;
+
+	for (l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+		for (shift = 0; shift <= MAX_SHIFT; shift++)
+			test_float_to(isa, lengths[l], shift);
+	}
+}
+
+/*
+ * Dither
+ * ======
+ *
+ * Both versions start from the same state and must leave
+ * the same one. Samples are converted in two calls, so
+ * the state is carried over.
+ */
+
+static void
+test_dither_to(unsigned int isa, unsigned int samples, unsigned int channels,
+               int shaping, unsigned int shift)
+{
+	struct sndmix_dither da, db;
+	float *src = (float*) buffers[0] + shift;
+	int16_t *a = (int16_t*) buffers[MAX_SOURCES] + shift;
+	int16_t *b = (int16_t*) buffers[MAX_SOURCES + 1] + shift;
+	unsigned int half = samples / 2;
+
+	fill_float_wide(src, samples);
+	sndmix_dither_init(&da, channels, shaping, random32());
+	db = da;
+
+	sndmix_float_to_s16_dither(a, src, half, &da);
+	sndmix_float_to_s16_dither(a + half, src + half, samples - half, &da);
+	sndmix_float_to_s16_dither_generic(b, src, half, &db);
+	sndmix_float_to_s16_dither_generic(b + half, src + half,
+	                                   samples - half, &db);
+
+	check("sndmix_float_to_s16_dither", isa, a, b, samples * sizeof(*a),
+	      channels, samples, shift);
+	check("sndmix_dither state", isa, &da, &db, sizeof(da), channels,
+	      samples, shift);
+}
+
+static void
+test_dither(unsigned int isa)
+{
+	unsigned int l, channels, shift;
+
+	for (l = 0; l < sizeof(lengths) / sizeof(*lengths); l++) {
+		for (channels = 1; channels <= 3; channels++) {
+			for (shift = 0; shift <= MAX_SHIFT; shift++) {
+				test_dither_to(isa, lengths[l], channels, 0,
+				               shift);
+				test_dither_to(isa, lengths[l], channels, 1,
+				               shift);
+			}
+		}
+	}
+}
+
+/* shaping needs the error of each channel, none is off */
+static void
+test_dither_channels(void)
+{
+	struct sndmix_dither d;
+
+	checks++;
+	sndmix_dither_init(&d, 0, 1, 1);
+	if (d.shaping) {
+		failures++;
+		printf("FAIL dither: shaping with no channel\n");
+	}
+
+	checks++;
+	sndmix_dither_init(&d, SNDMIX_DITHER_CHANNELS + 1, 1, 1);
+	if (d.shaping) {
+		failures++;
+		printf("FAIL dither: shaping with %u channels\n",
+		       SNDMIX_DITHER_CHANNELS + 1);
+	}
+}
+
+/*
+ * Gain and pan
+ * ============
+ */
+
+/* random gain from -2.0 to 2.0, sometimes exactly 0 or 1 */
+static float
+random_gain(void)
+{
+	switch (random32() % 8) {
+	case 0:
+		return 0.0f;
+	case 1:
+		return 1.0f;
+	default:
+		return (int32_t) random32() / 1073741824.0f;
+	}
+}
+
+/*
+ * Both versions start from the same gains and must leave
+ * them at the same place.
+ */
+static void
+test_gain_mix(unsigned int isa, unsigned int count, unsigned int frames,
+              unsigned int channels, unsigned int shift)
+{
+	struct sndmix_gain ga[MAX_SOURCES], gb[MAX_SOURCES];
+	struct sndmix_gain *pa[MAX_SOURCES], *pb[MAX_SOURCES];
+	const void *src[MAX_SOURCES];
+	unsigned int samples = frames * channels;
+	char *a = buffers[MAX_SOURCES] + shift * sizeof(float);
+	char *b = buffers[MAX_SOURCES + 1] + shift * sizeof(float);
+	unsigned int j;
+	int ramp;
+
+	for (j = 0; j < count; j++) {
+		src[j] = buffers[j] + (shift + j) % (MAX_SHIFT + 1) *
+		         sizeof(float);
+
+		ramp = random32() & 1 ? SNDMIX_RAMP_EXP : SNDMIX_RAMP_LINEAR;
+		sndmix_gain_init(&ga[j], random_gain(),
+		                 (int32_t) random32() / 2147483648.0f, ramp,
+		                 channels);
+		ga[j].gain = random_gain();
+		ga[j].pan = (int32_t) random32() / 2147483648.0f;
+		gb[j] = ga[j];
+		pa[j] = &ga[j];
+		pb[j] = &gb[j];
+	}
+
+	for (j = 0; j < count; j++)
+		fill_16((int16_t*) src[j], samples);
+	sndmix_n_16_gain((int16_t*) a, (const int16_t**) src, pa, count,
+	                 frames, channels);
+	sndmix_n_16_gain_generic((int16_t*) b, (const int16_t**) src, pb,
+	                         count, frames, channels);
+	check("sndmix_n_16_gain", isa, a, b, samples * sizeof(int16_t),
+	      count, samples, shift);
+
+	for (j = 0; j < count; j++)
+		fill_float((float*) src[j], samples);
+	sndmix_n_float_gain((float*) a, (const float**) src, pa, count,
+	                    frames, channels);
+	sndmix_n_float_gain_generic((float*) b, (const float**) src, pb,
+	                            count, frames, channels);
+	check("sndmix_n_float_gain", isa, a, b, samples * sizeof(float),
+	      count, samples, shift);
+
+	checks++;
+	for (j = 0; j < count; j++) {
+		if (memcmp(ga[j].current, gb[j].current,
+		           sizeof(ga[j].current)) != 0) {
+			failures++;
+			printf("FAIL gain current (%s): %u sources, "
+			       "%u frames\n", isa_names[isa], count, frames);
+			break;
+		}
+	}
+}
+
+static void
+test_gain(unsigned int isa)
+{
+	static const unsigned int counts[] = {0, 1, 2, 5, 16};
+	static const unsigned int channels[] = {1, 2, 3, 4, 6, 8};
+	unsigned int c, n, l, shift;
+
+	for (c = 0; c < sizeof(counts) / sizeof(*counts); c++) {
+		for (n = 0; n < sizeof(channels) / sizeof(*channels); n++) {
+			for (l = 0; l < sizeof(lengths) / sizeof(*lengths);
+			     l++) {
+				/* buffers hold MAX_SAMPLES samples */
+				if (lengths[l] * channels[n] > MAX_SAMPLES)
+					continue;
+				for (shift = 0; shift <= MAX_SHIFT; shift++)
+					test_gain_mix(isa, counts[c],
+					              lengths[l], channels[n],
+					              shift);
+			}
+		}
+	}
+}
+
+/*
+ * An exponential ramp between two negative gains stays
+ * negative and between them.
+ */
+static void
+test_gain_sign(void)
+{
+	struct sndmix_gain g, *pg = &g;
+	const float *src = (float*) buffers[0];
+	float *dst = (float*) buffers[MAX_SOURCES];
+	unsigned int i;
+
+	for (i = 0; i < 1000; i++)
+		((float*) src)[i] = 1.0f;
+
+	sndmix_gain_init(&g, -1.0f, 0.0f, SNDMIX_RAMP_EXP, 1);
+	g.gain = -0.5f;
+	sndmix_n_float_gain_generic(dst, &src, &pg, 1, 1000, 1);
+
+	checks++;
+	for (i = 0; i < 1000; i++) {
+		if (dst[i] > -0.5f || dst[i] < -1.0f) {
+			failures++;
+			printf("FAIL exponential ramp: frame %u is %f\n", i,
+			       dst[i]);
+			return;
+		}
+	}
+}
+
+/*
+ * Dynamics
+ * ========
+ */
+
+#define DYNAMICS_RATE      48000
+#define DYNAMICS_CHANNELS  2
+#define DYNAMICS_FRAMES    (DYNAMICS_RATE / 2)
+
+static float dynamics_in[DYNAMICS_FRAMES * DYNAMICS_CHANNELS];
+static float dynamics_out[DYNAMICS_FRAMES * DYNAMICS_CHANNELS];
+
+/*
+ * run the limiter on dynamics_in in chunks of random
+ * length, into dynamics_out
+ */
+static int
+limit(unsigned int lookahead, float ceiling_db, unsigned int frames)
+{
+	struct mix_limiter l;
+	unsigned int done, chunk;
+
+	if (mix_limiter_open(&l, DYNAMICS_CHANNELS, DYNAMICS_RATE, lookahead,
+	                     ceiling_db, 50.0f) == -1) {
+		failures++;
+		printf("FAIL limiter: unable to open\n");
+		return -1;
+	}
+
+	memcpy(dynamics_out, dynamics_in,
+	       frames * DYNAMICS_CHANNELS * sizeof(float));
+
+	for (done = 0; done < frames; done += chunk) {
+		chunk = 1 + random32() % 300;
+		if (chunk > frames - done)
+			chunk = frames - done;
+		mix_limiter_run(&l, dynamics_out + done * DYNAMICS_CHANNELS,
+		                chunk);
+	}
+
+	mix_limiter_close(&l);
+
+	return 0;
+}
+
+/*
+ * Loud random frames, single frame spikes and silence.
+ * The last lookahead frames are silence, so every frame
+ * is out of the delay line at the end.
+ */
+static void
+test_limiter_ceiling(unsigned int lookahead)
+{
+	float ceiling = powf(10.0f, -1.0f / 20);
+	unsigned int frames = DYNAMICS_FRAMES;
+	unsigned int i;
+
+	for (i = 0; i < frames * DYNAMICS_CHANNELS; i++) {
+		if (i / DYNAMICS_CHANNELS >= frames - lookahead ||
+		    i / 4096 % 4 == 3)
+			dynamics_in[i] = 0.0f;
+		else
+			dynamics_in[i] = 4.0f * (int32_t) random32() /
+			                 2147483648.0f;
+	}
+
+	/* spikes, also next to silence */
+	for (i = 0; i < 64; i++)
+		dynamics_in[random32() % ((frames - lookahead) *
+		                          DYNAMICS_CHANNELS)] =
+			random32() & 1 ? 50.0f : -50.0f;
+
+	if (limit(lookahead, -1.0f, frames) == -1)
+		return;
+
+	checks++;
+	for (i = 0; i < frames * DYNAMICS_CHANNELS; i++) {
+		if (fabsf(dynamics_out[i]) > ceiling) {
+			failures++;
+			printf("FAIL limiter: lookahead %u, frame %u is %f, "
+			       "ceiling %f\n", lookahead, i / DYNAMICS_CHANNELS,
+			       dynamics_out[i], ceiling);
+			return;
+		}
+	}
+}
+
+/* a single frame above ceiling in silence */
+static void
+test_limiter_spike(unsigned int lookahead)
+{
+	float ceiling = powf(10.0f, -3.0f / 20);
+	unsigned int frames = 2 * lookahead + 100;
+	unsigned int spike = lookahead + 10;
+	float *out;
+
+	memset(dynamics_in, 0, frames * DYNAMICS_CHANNELS * sizeof(float));
+	dynamics_in[spike * DYNAMICS_CHANNELS] = 8.0f;
+	dynamics_in[spike * DYNAMICS_CHANNELS + 1] = -2.0f;
+
+	if (limit(lookahead, -3.0f, frames) == -1)
+		return;
+
+	/* it's reduced to ceiling, not removed */
+	out = dynamics_out + (spike + lookahead) * DYNAMICS_CHANNELS;
+	checks++;
+	if (out[0] > ceiling || out[0] < 0.99f * ceiling ||
+	    out[1] != out[0] * -2.0f / 8.0f) {
+		failures++;
+		printf("FAIL limiter spike: lookahead %u, frame is %f %f, "
+		       "ceiling %f\n", lookahead, out[0], out[1], ceiling);
+	}
+}
+
+/* below ceiling, output is the input delayed by lookahead */
+static void
+test_limiter_delay(unsigned int lookahead)
+{
+	unsigned int frames = DYNAMICS_FRAMES;
+	unsigned int samples = frames * DYNAMICS_CHANNELS;
+	unsigned int delay = lookahead * DYNAMICS_CHANNELS;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++)
+		dynamics_in[i] = 0.5f * (int32_t) random32() / 2147483648.0f;
+
+	if (limit(lookahead, 0.0f, frames) == -1)
+		return;
+
+	checks++;
+	for (i = 0; i < samples; i++) {
+		if (dynamics_out[i] != (i < delay ? 0.0f :
+		                        dynamics_in[i - delay])) {
+			failures++;
+			printf("FAIL limiter delay: lookahead %u, frame %u\n",
+			       lookahead, i / DYNAMICS_CHANNELS);
+			return;
+		}
+	}
+}
+
+static void
+test_limiter(void)
+{
+	static const unsigned int lookaheads[] = {0, 1, 2, 63, 64, 480};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(lookaheads) / sizeof(*lookaheads); i++) {
+		test_limiter_ceiling(lookaheads[i]);
+		test_limiter_spike(lookaheads[i]);
+		test_limiter_delay(lookaheads[i]);
+	}
+}
+
+/*
+ * A steady sine must end at the gain of the static curve:
+ * level above threshold is divided by ratio, then makeup
+ * is added. The sine is 3000 Hz, a period is a block of
+ * the compressor, so the peak of every block is the
+ * amplitude.
+ */
+static void
+test_compressor_sine(float amplitude_db, float threshold_db, float ratio,
+                     float makeup_db)
+{
+	struct mix_compressor c;
+	float amplitude = powf(10.0f, amplitude_db / 20);
+	float expected_db = makeup_db;
+	float gain_db;
+	unsigned int frames = DYNAMICS_FRAMES;
+	unsigned int done, chunk;
+	unsigned int i;
+	float *last;
+
+	for (i = 0; i < frames; i++) {
+		dynamics_out[i * DYNAMICS_CHANNELS] = amplitude *
+			sinf(2 * M_PI * 3000 * i / DYNAMICS_RATE);
+		dynamics_out[i * DYNAMICS_CHANNELS + 1] =
+			dynamics_out[i * DYNAMICS_CHANNELS] / 2;
+	}
+
+	if (amplitude_db > threshold_db)
+		expected_db += (threshold_db - amplitude_db) *
+		               (1.0f - 1.0f / ratio);
+
+	mix_compressor_init(&c, DYNAMICS_CHANNELS, DYNAMICS_RATE, threshold_db,
+	                    ratio, 5.0f, 50.0f, makeup_db);
+
+	/* blocks of the compressor cross the chunks */
+	for (done = 0; done < frames; done += chunk) {
+		chunk = 1 + random32() % 300;
+		if (chunk > frames - done)
+			chunk = frames - done;
+		mix_compressor_run(&c, dynamics_out + done * DYNAMICS_CHANNELS,
+		                   chunk);
+	}
+
+	/* a quarter of the last period, the peak of the sine */
+	last = dynamics_out + (frames - 16 + 4) * DYNAMICS_CHANNELS;
+	gain_db = 20 * log10f(last[0] / amplitude);
+
+	checks++;
+	if (fabsf(gain_db - expected_db) > 0.01f ||
+	    fabsf(last[1] - last[0] / 2) > 1e-6f) {
+		failures++;
+		printf("FAIL compressor: %.1f dB, threshold %.1f dB, ratio "
+		       "%.1f: gain %.3f dB, expected %.3f dB\n", amplitude_db,
+		       threshold_db, ratio, gain_db, expected_db);
+	}
+}
+
+static void
+test_compressor(void)
+{
+	test_compressor_sine(-1.0f, -20.0f, 4.0f, 0.0f);
+	test_compressor_sine(-6.0f, -12.0f, 2.0f, 3.0f);
+	test_compressor_sine(-3.0f, -30.0f, 20.0f, 6.0f);
+	/* below threshold, only makeup */
+	test_compressor_sine(-24.0f, -20.0f, 4.0f, 2.0f);
+	/* ratio 1 is no compression */
+	test_compressor_sine(-1.0f, -20.0f, 1.0f, 0.0f);
+}
+
+int
+main(void)
+{
+	size_t bytes = (MAX_SAMPLES + MAX_SHIFT) * sizeof(int32_t);
+	unsigned int isa;
+	unsigned int i;
+
+	/* rounded up to ALIGN, as aligned_alloc() requires */
+	bytes = (bytes + ALIGN - 1) / ALIGN * ALIGN;
+	for (i = 0; i < MAX_SOURCES + 3; i++) {
+		buffers[i] = aligned_alloc(ALIGN, bytes);
+		if (!buffers[i])
+			return 1;
+		memset(buffers[i], 0, bytes);
+	}
+
+	for (isa = SNDMIX_ISA_SSE2; isa <= SNDMIX_ISA_BEST; isa++) {
+		if (sndmix_select(isa) != isa) {
+			printf("%s: not supported, skipped\n", isa_names[isa]);
+			continue;
+		}
+
+		test_mix(isa);
+		test_float(isa);
+		test_gain(isa);
+		test_dither(isa);
+		printf("%s: tested\n", isa_names[isa]);
+	}
+
+	sndmix_select(SNDMIX_ISA_BEST);
+	test_gain_sign();
+	test_dither_channels();
+	test_limiter();
+	test_compressor();
+
+	for (i = 0; i < MAX_SOURCES + 3; i++)
+		free(buffers[i]);
+
+	printf("mix_test: %u checks, %u failures\n", checks, failures);
+
+	return failures != 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Check mix_server on snd-aloop
+ *
+ * Runs ./mix_server on device 0 of the loopback card and
+ * captures what it plays from device 1 (usage:
+ * server_test [card]).
+ *
+ * Two clients write constant frames, the capture must hold
+ * their sum. Then a client corrupts the size and pointers
+ * of its ring, the server must keep running and exit
+ * cleanly on SIGTERM.
+ *
+ * Exit status is 1 if a check fails.
+ */
+
+#include <errno.h>     /* errno */
+#include <signal.h>    /* kill(), SIGTERM */
+#include <stdint.h>    /* int16_t */
+#include <stdio.h>     /* printf(), snprintf() */
+#include <stdlib.h>    /* atoi() */
+#include <string.h>    /* strerror() */
+#include <sys/wait.h>  /* waitpid() */
+#include <time.h>      /* nanosleep() */
+#include <unistd.h>    /* fork(), execl(), alarm() */
+
+#include "mix_server.h"
+#include "sound.h"
+
+#define SERVER_NAME  "simplesound-server-test"
+
+#define CHANNELS     2
+#define RATE         48000
+#define PERIOD_SIZE  1024
+
+/* samples of each client, and seconds they are played */
+#define SAMPLE_A  1000
+#define SAMPLE_B  234
+#define SECONDS   1
+
+/* seconds before a stalled test is killed (SIGALRM) */
+#define TIMEOUT  20
+
+static unsigned int failures;
+
+static void
+sleep_ms(long ms)
+{
+	struct timespec ts = { ms / 1000, ms % 1000 * 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static pid_t
+start_server(unsigned int card)
+{
+	char card_arg[16];
+	pid_t pid;
+
+	snprintf(card_arg, sizeof(card_arg), "%u", card);
+
+	pid = fork();
+	if (pid == 0) {
+		execl("./mix_server", "mix_server", "-c", card_arg, "-d", "0",
+		      "-r", "48000", "-s", SERVER_NAME, (char*) NULL);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+/* retry until server listens */
+static int
+connect_client(struct mix_client *c)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		if (mix_client_open(c, SERVER_NAME) == 0)
+			return 0;
+		sleep_ms(20);
+	}
+
+	return -1;
+}
+
+/* keep the ring of a client full of its sample */
+static void
+feed(struct mix_client *c, int16_t sample)
+{
+	int16_t frames[PERIOD_SIZE * CHANNELS];
+	unsigned int i;
+
+	for (i = 0; i < PERIOD_SIZE * CHANNELS; i++)
+		frames[i] = sample;
+
+	while (mix_client_write(c, frames, PERIOD_SIZE) == PERIOD_SIZE)
+		;
+}
+
+/*
+ * feed both clients while capturing, count frames
+ * holding the sum and frames holding something else
+ * than the sum, a single client or silence
+ */
+static int
+test_sum(struct snd *capture, struct mix_client *a, struct mix_client *b)
+{
+	int16_t buffer[PERIOD_SIZE * CHANNELS];
+	unsigned long periods, p;
+	unsigned long sums = 0, corrupt = 0;
+	unsigned int i;
+	int16_t s;
+
+	periods = SECONDS * RATE / PERIOD_SIZE;
+	for (p = 0; p < periods; p++) {
+		feed(a, SAMPLE_A);
+		feed(b, SAMPLE_B);
+
+		if (snd_read(capture, buffer, PERIOD_SIZE) != PERIOD_SIZE) {
+			printf("capture: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < PERIOD_SIZE; i++) {
+			s = buffer[i * CHANNELS];
+			if (s == SAMPLE_A + SAMPLE_B &&
+			    buffer[i * CHANNELS + 1] == s)
+				sums++;
+			else if (s != 0 && s != SAMPLE_A && s != SAMPLE_B)
+				corrupt++;
+		}
+	}
+
+	printf("sum: %lu of %lu frames, %lu corrupt, underfed %lu + %lu\n",
+	       sums, periods * PERIOD_SIZE, corrupt, a->ring->underfed,
+	       b->ring->underfed);
+
+	/* first periods are silence, before clients are mixed */
+	if (sums < periods * PERIOD_SIZE / 2 || corrupt != 0) {
+		failures++;
+		printf("FAIL sum\n");
+	}
+
+	return 0;
+}
+
+/* a client breaks its ring, server must not trust it */
+static void
+test_corrupt_ring(struct mix_client *c)
+{
+	struct mix_server_ring *ring = c->ring;
+
+	ring->read_ptr += 1UL << 40;
+	ring->write_ptr -= 12345;
+	sleep_ms(100);
+
+	ring->read_ptr = 0;
+	ring->write_ptr = ~0UL;
+	sleep_ms(100);
+
+	/* size and read_ptr of the server are its own */
+	ring->size = 1U << 30;
+	sleep_ms(100);
+
+	ring->size = 0;
+	sleep_ms(100);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int card = argc > 1 ? atoi(argv[1]) : 0;
+	struct mix_client a, b;
+	struct snd_config cfg;
+	struct snd capture;
+	pid_t server;
+	int status;
+
+	alarm(TIMEOUT);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = SND_INPUT;
+	cfg.card = card;
+	cfg.device = 1;
+	cfg.format = SND_FORMAT_S16_LE;
+	cfg.channels = CHANNELS;
+	cfg.rate = RATE;
+	cfg.period_size = PERIOD_SIZE;
+	cfg.period_count = 4;
+
+	server = start_server(card);
+	if (server == -1)
+		goto _go_error;
+
+	if (connect_client(&a) == -1)
+		goto _go_kill;
+	if (mix_client_open(&b, SERVER_NAME) == -1)
+		goto _go_close_a;
+
+	if (a.ring->format != SND_FORMAT_S16_LE ||
+	    a.ring->channels != CHANNELS) {
+		printf("server format is not S16_LE stereo\n");
+		goto _go_close_b;
+	}
+
+	if (snd_open(&capture, &cfg) == -1)
+		goto _go_close_b;
+	if (snd_start(&capture) == -1)
+		goto _go_close_capture;
+
+	if (test_sum(&capture, &a, &b) == -1)
+		goto _go_close_capture;
+
+	snd_close(&capture);
+
+	test_corrupt_ring(&b);
+
+	mix_client_close(&b);
+	mix_client_close(&a);
+
+	if (kill(server, SIGTERM) == -1 || waitpid(server, &status, 0) == -1)
+		goto _go_error;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		failures++;
+		printf("FAIL server: status 0x%x after corrupt ring\n", status);
+	}
+
+	printf("server_test: %u failures\n", failures);
+
+	return failures != 0;
+
+_go_close_capture:
+	snd_close(&capture);
+_go_close_b:
+	mix_client_close(&b);
+_go_close_a:
+	mix_client_close(&a);
+_go_kill:
+	kill(server, SIGTERM);
+	waitpid(server, &status, 0);
+_go_error:
+	printf("server_test: %s\n", strerror(errno));
+	return 1;
+}
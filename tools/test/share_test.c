@@ -0,0 +1,294 @@
+/*
+ * simple Linux sound library
+ * Copyright (C) 2018  Ricardo Biehl Pasquali
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Check snd_share_*() on a sound device
+ *
+ * Needs a device that can be opened with SND_MMAP and
+ * S16_LE stereo at 48000 Hz, e.g. snd-dummy or snd-aloop
+ * (usage: share_test [card] [device]).
+ *
+ * Playback: two shares of the device (owner and attached)
+ * mix at the same position. The device buffer must hold
+ * the saturated sum, lap after lap of the ring, also when
+ * a process left a clear claim behind.
+ *
+ * Capture: two shares read the same frames. After the
+ * owner closes, the other one keeps getting frames.
+ *
+ * Exit status is 1 if a check fails.
+ */
+
+#include <errno.h>  /* errno */
+#include <stdint.h> /* int16_t */
+#include <stdio.h>  /* printf() */
+#include <stdlib.h> /* atoi() */
+#include <string.h> /* memcmp(), memset(), strerror() */
+#include <unistd.h> /* alarm() */
+
+#include "sound.h"
+
+#define CHANNELS     2
+#define RATE         48000
+#define PERIOD_SIZE  1024
+
+/* laps of the ring to mix, before and after a stale claim */
+#define LAPS  3
+
+/* seconds before a stalled test is killed (SIGALRM) */
+#define TIMEOUT  20
+
+static unsigned int checks;
+static unsigned int failures;
+
+static void
+fail(const char *what, unsigned long frame, int got, int expected)
+{
+	failures++;
+	printf("FAIL %s: frame %lu is %d, expected %d\n", what, frame, got,
+	       expected);
+}
+
+static void
+open_config(struct snd_config *cfg, unsigned int flags, unsigned int card,
+            unsigned int device)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->flags = flags;
+	cfg->card = card;
+	cfg->device = device;
+	cfg->format = SND_FORMAT_S16_LE;
+	cfg->channels = CHANNELS;
+	cfg->rate = RATE;
+	cfg->period_size = PERIOD_SIZE;
+	cfg->period_count = 4;
+}
+
+/*
+ * Playback
+ * ========
+ */
+
+/* two sources per round: near full scale (saturated sums) and small */
+static int16_t
+source_sample(unsigned int source, unsigned long round, unsigned int i)
+{
+	if (i % 4 == 0)
+		return source ? 30000 : 20000;
+	if (i % 4 == 1)
+		return source ? -30000 : -20000;
+
+	return (source + 1) * 100 + round % 50 - (int) (i % 7);
+}
+
+static int16_t
+saturate(int sum)
+{
+	if (sum > INT16_MAX)
+		return INT16_MAX;
+	if (sum < INT16_MIN)
+		return INT16_MIN;
+	return sum;
+}
+
+/*
+ * Mix a period from both shares at the same position and
+ * check it in the device buffer, before it's played.
+ */
+static int
+mix_round(struct snd_share *a, struct snd_share *b, unsigned long round)
+{
+	int16_t src[2][PERIOD_SIZE * CHANNELS];
+	const int16_t *buffer = a->snd.mmap_buffer;
+	unsigned long start, offset;
+	unsigned int i, s;
+	int expected;
+
+	if (snd_share_wait(a, PERIOD_SIZE) == -1)
+		return -1;
+
+	for (s = 0; s < 2; s++) {
+		for (i = 0; i < PERIOD_SIZE * CHANNELS; i++)
+			src[s][i] = source_sample(s, round, i);
+	}
+
+	/* same position in both, the one further ahead */
+	if (a->appl_ptr - b->appl_ptr < a->snd.boundary / 2)
+		b->appl_ptr = a->appl_ptr;
+	else
+		a->appl_ptr = b->appl_ptr;
+	start = a->appl_ptr;
+
+	if (snd_share_write(a, src[0], PERIOD_SIZE) != PERIOD_SIZE ||
+	    snd_share_write(b, src[1], PERIOD_SIZE) != PERIOD_SIZE) {
+		printf("FAIL playback: no room for a period\n");
+		failures++;
+		return 0;
+	}
+
+	checks++;
+	for (i = 0; i < PERIOD_SIZE * CHANNELS; i++) {
+		offset = (start + i / CHANNELS) % a->snd.buffer_size;
+		expected = saturate(src[0][i] + src[1][i]);
+		if (buffer[offset * CHANNELS + i % CHANNELS] != expected) {
+			fail("playback sum", start + i / CHANNELS,
+			     buffer[offset * CHANNELS + i % CHANNELS],
+			     expected);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int
+test_playback(unsigned int card, unsigned int device)
+{
+	struct snd_share a, b;
+	struct snd_config cfg;
+	unsigned long rounds, round;
+
+	open_config(&cfg, SND_OUTPUT, card, device);
+	if (snd_share_open(&a, &cfg) == -1)
+		goto _go_error;
+	if (snd_share_open(&b, &cfg) == -1) {
+		snd_share_close(&a);
+		goto _go_error;
+	}
+
+	rounds = LAPS * a.snd.buffer_size / PERIOD_SIZE;
+	for (round = 0; round < rounds; round++) {
+		if (mix_round(&a, &b, round) == -1)
+			goto _go_close;
+	}
+
+	/* a process stopped while clearing, it's taken over */
+	__atomic_store_n(&a.area->clear_claim, a.area->clear_ptr + 1,
+	                 __ATOMIC_RELEASE);
+
+	for (; round < 2 * rounds; round++) {
+		if (mix_round(&a, &b, round) == -1)
+			goto _go_close;
+	}
+
+	printf("playback: %lu periods mixed, %lu + %lu frames late\n",
+	       round, a.underrun, b.underrun);
+
+	snd_share_close(&b);
+	snd_share_close(&a);
+
+	return 0;
+
+_go_close:
+	snd_share_close(&b);
+	snd_share_close(&a);
+_go_error:
+	printf("playback: %s\n", strerror(errno));
+	return -1;
+}
+
+/*
+ * Capture
+ * =======
+ */
+
+/* wait for and read a period */
+static ssize_t
+read_period(struct snd_share *share, int16_t *dst)
+{
+	if (snd_share_wait(share, PERIOD_SIZE) == -1)
+		return -1;
+
+	return snd_share_read(share, dst, PERIOD_SIZE);
+}
+
+static int
+test_capture(unsigned int card, unsigned int device)
+{
+	int16_t dst[2][PERIOD_SIZE * CHANNELS];
+	struct snd_share a, b;
+	struct snd_config cfg;
+	unsigned long rounds, round;
+	unsigned long frames = 0;
+
+	open_config(&cfg, SND_INPUT, card, device);
+	if (snd_share_open(&a, &cfg) == -1)
+		goto _go_error;
+	if (snd_share_open(&b, &cfg) == -1) {
+		snd_share_close(&a);
+		goto _go_error;
+	}
+
+	b.appl_ptr = a.appl_ptr;
+	rounds = LAPS * a.snd.buffer_size / PERIOD_SIZE;
+
+	for (round = 0; round < rounds; round++) {
+		if (read_period(&a, dst[0]) != PERIOD_SIZE ||
+		    snd_share_read(&b, dst[1], PERIOD_SIZE) != PERIOD_SIZE) {
+			snd_share_close(&b);
+			snd_share_close(&a);
+			goto _go_error;
+		}
+
+		checks++;
+		if (memcmp(dst[0], dst[1], sizeof(dst[0])) != 0) {
+			failures++;
+			printf("FAIL capture: shares read different frames\n");
+		}
+	}
+
+	/* hw_ptr isn't published anymore */
+	snd_share_close(&a);
+
+	for (round = 0; round < rounds; round++) {
+		if (read_period(&b, dst[1]) != PERIOD_SIZE) {
+			snd_share_close(&b);
+			goto _go_error;
+		}
+		frames += PERIOD_SIZE;
+	}
+
+	checks++;
+	printf("capture: %lu frames read after owner left, %lu lost\n",
+	       frames, b.overrun);
+
+	snd_share_close(&b);
+
+	return 0;
+
+_go_error:
+	printf("capture: %s\n", strerror(errno));
+	return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int card = argc > 1 ? atoi(argv[1]) : 0;
+	unsigned int device = argc > 2 ? atoi(argv[2]) : 0;
+
+	alarm(TIMEOUT);
+
+	if (test_playback(card, device) == -1 ||
+	    test_capture(card, device) == -1)
+		return 1;
+
+	printf("share_test: %u checks, %u failures\n", checks, failures);
+
+	return failures != 0;
+}
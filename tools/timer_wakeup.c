@@ -30,11 +30,6 @@
 #include <unistd.h>       /* close() */
 #include <time.h>         /* clock_gettime() */
 
-#include <sys/ioctl.h>  /* ioctl() */
-
-/* ALSA header */
-#include <sound/asound.h>
-
 #include "deviation_average.h"
 #include "smooth_correction.h"
 #include "sound.h"
@@ -77,38 +72,36 @@ filled(struct snd *snd, unsigned long hw_ptr, unsigned long appl_ptr)
  * interrupts must be enabled and HWSYNC operation should
  * never be done.
  *
- * NOTE: If using mmaped status, hardware may interrupt
- * while status->hw_ptr and status->tstamp are being read.
- * Therefore, status is requested using ioctl() hoping
- * hw_ptr and tstamp will be get atomically.
+ * NOTE: hw_ptr and tstamp of the last interrupt are read
+ * with snd_position_snapshot(), which doesn't call
+ * ioctl() if status is mmaped.
  */
 static unsigned long
 predict_hardware_pointer(struct snd *snd, struct snd_timer *snd_timer)
 {
-	struct snd_pcm_sync_ptr sync_ptr;
+	unsigned long hw_ptr;
+	struct timespec tstamp;
 	struct timespec now;
 	struct timespec diff;
 	int64_t diff_ns;
 	unsigned long estimate;
 
-	/* get information from kernel */
-	sync_ptr.flags = SNDRV_PCM_SYNC_PTR_APPL |
-	                 SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
-	/* TODO: do error check */
-	ioctl(snd->fd, SNDRV_PCM_IOCTL_SYNC_PTR, &sync_ptr);
+	/* get hw_ptr and timestamp of last interrupt */
+	if (snd_position_snapshot(snd, &hw_ptr, &tstamp) < 0)
+		return snd->status->hw_ptr;
 
 	/* get now */
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	/* TODO: support CLOCK_REALTIME? */
 
 	/* time difference between now and last interrupt */
-	diff = timespec_sub(&now, &sync_ptr.s.status.tstamp);
+	diff = timespec_sub(&now, &tstamp);
 	diff_ns = timespec_to_ns(&diff);
 
 	/* estimate of frames since last interrupt */
 	estimate = diff_ns / snd_timer->frame_ns;
 
-	return sync_ptr.s.status.hw_ptr + estimate;
+	return hw_ptr + estimate;
 }
 
 /*
@@ -25,13 +25,16 @@
  */
 
 #include <errno.h>
-#include <poll.h>   /* poll() */
-#include <stdio.h>  /* printf() */
-#include <stdlib.h> /* labs() */
-#include <stdint.h> /* int*_t */
-#include <string.h> /* memset(), strerror() */
+#include <fcntl.h>    /* open() */
+#include <poll.h>     /* poll() */
+#include <stdio.h>    /* printf() */
+#include <stdlib.h>   /* labs() */
+#include <stdint.h>   /* int*_t */
+#include <string.h>   /* memcmp(), memset(), strerror() */
 #include <signal.h>
-#include <unistd.h> /* getopt() */
+#include <sys/mman.h> /* mmap(), madvise() */
+#include <sys/stat.h> /* fstat() */
+#include <unistd.h>   /* getopt() */
 
 #if defined(DEADLINE_WAKEUP)
 #include <sched.h>  /* sched_yield() */
@@ -39,6 +42,7 @@
 
 #include "sound.h"       /* snd_*() */
 #include "mix_utility.h" /* sndmix_*() */
+#include "read_ahead.h"  /* read_ahead_*() */
 
 #if defined(DEADLINE_WAKEUP) || defined(TIMER_WAKEUP)
 #include "deadline_wakeup.h"
@@ -52,6 +56,9 @@
 #define CHUNK_INFO  0x20746d66
 #define CHUNK_DATA  0x61746164
 
+/* periods read ahead of the real-time loop */
+#define READ_AHEAD_PERIODS  8
+
 /*
  * Wave files (.wav) are RIFF (Resource Interchange File
  * Format) files with information about the audio and the
@@ -102,13 +109,82 @@ struct sound_info {
 	uint16_t bits_per_sample;
 };
 
+/* format codes of info chunk */
+#define WAVE_FORMAT_PCM         1
+#define WAVE_FORMAT_FLOAT       3
+#define WAVE_FORMAT_EXTENSIBLE  0xfffe
+
+/*
+ * info chunk of WAVE_FORMAT_EXTENSIBLE files (more than
+ * two channels or 16 bits). The format code is in the
+ * first two bytes of sub_format, a GUID.
+ */
+struct sound_info_extensible {
+	struct sound_info info;
+	uint16_t size; /* of the members below */
+	uint16_t valid_bits;
+	uint32_t channel_mask;
+	uint8_t sub_format[16];
+};
+
+/* rest of KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT GUIDs */
+static const uint8_t sub_format_guid[14] = {
+	0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+	0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+};
+
+/* format code of an extensible info chunk, 0 if unknown */
+static uint16_t
+sub_format(const char *chunk, size_t size)
+{
+	struct sound_info_extensible ext;
+
+	if (size < sizeof(ext))
+		return 0;
+	memcpy(&ext, chunk, sizeof(ext));
+
+	if (memcmp(ext.sub_format + 2, sub_format_guid,
+	           sizeof(sub_format_guid)) != 0)
+		return 0;
+
+	return ext.sub_format[0] | ext.sub_format[1] << 8;
+}
+
+/* sound device format of a file, -1 if it can't be mixed */
+static int
+sound_format(struct sound_info *info)
+{
+	if (info->format == WAVE_FORMAT_FLOAT && info->bits_per_sample == 32)
+		return SND_FORMAT_FLOAT_LE;
+	if (info->format != WAVE_FORMAT_PCM)
+		return -1;
+
+	switch (info->bits_per_sample) {
+	case 16:
+		return SND_FORMAT_S16_LE;
+	case 24:
+		return SND_FORMAT_S24_3LE;
+	case 32:
+		return SND_FORMAT_S32_LE;
+	}
+
+	return -1;
+}
+
 /*
  * Structure representing a file. Multiple files can be
  * opened and mixed together.
+ *
+ * The file is memory mapped, data points to the audio
+ * in the data chunk.
  */
 struct file {
-	FILE *file;
+	void *map;
+	size_t map_size;
+	const char *data;
+	size_t data_size;
 	struct sound_info info;
+	struct read_ahead ra;
 };
 
 static volatile sig_atomic_t _keep_running = 1;
@@ -120,61 +196,176 @@ on_signal(int sig)
 	_keep_running = 0;
 }
 
+static void
+close_file(struct file *f)
+{
+	munmap(f->map, f->map_size);
+}
+
 static int
 open_file(struct file *f, char *filename)
 {
-	struct riff_header header;
-	struct chunk_header chunk_header;
-	struct sound_info *info;
-	int more_chunks = 1;
-
-	info = &f->info;
-
-	f->file = fopen(filename, "r");
-	if (f->file == NULL) {
+	struct riff_header *header;
+	struct chunk_header *chunk_header;
+	struct stat st;
+	char *p, *end;
+	size_t left;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) {
 		fprintf(stderr, "Unable to open file '%s'\n", filename);
 		return -1;
 	}
 
-	fread(&header, sizeof(header), 1, f->file);
-	if (header.magic != RIFF_MAGIC || header.type != RIFF_TYPE_WAVE) {
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(*header)) {
 		fprintf(stderr, "Error: '%s' is not a riff/wave file\n",
 		        filename);
-		fclose(f->file);
+		close(fd);
 		return -1;
 	}
 
-	/* find INFO chunk */
+	f->map_size = st.st_size;
+	f->map = mmap(NULL, f->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		fprintf(stderr, "Unable to map file '%s'\n", filename);
+		return -1;
+	}
 
-	do {
-		fread(&chunk_header, sizeof(chunk_header), 1, f->file);
+	/* file is read from the beginning to the end */
+	madvise(f->map, f->map_size, MADV_SEQUENTIAL);
+
+	header = f->map;
+	if (header->magic != RIFF_MAGIC || header->type != RIFF_TYPE_WAVE) {
+		fprintf(stderr, "Error: '%s' is not a riff/wave file\n",
+		        filename);
+		goto _go_unmap;
+	}
+
+	/* find INFO and DATA chunks */
 
-		switch (chunk_header.id) {
+	p = (char*) (header + 1);
+	end = (char*) f->map + f->map_size;
+	f->data = NULL;
+
+	while (f->data == NULL && end - p >= sizeof(*chunk_header)) {
+		chunk_header = (struct chunk_header*) p;
+		p += sizeof(*chunk_header);
+		left = end - p;
+
+		switch (chunk_header->id) {
 		case CHUNK_INFO:
-			fread(info, sizeof(*info), 1, f->file);
-			/* If the format header is larger, skip the rest */
-			if (chunk_header.size > sizeof(*info))
-				fseek(f->file,
-				      chunk_header.size - sizeof(*info),
-				      SEEK_CUR);
+			if (left < sizeof(f->info))
+				goto _go_truncated;
+			memcpy(&f->info, p, sizeof(f->info));
+			if (f->info.format == WAVE_FORMAT_EXTENSIBLE)
+				f->info.format = sub_format(p,
+				                 chunk_header->size < left ?
+				                 chunk_header->size : left);
 			break;
 		case CHUNK_DATA:
 			/* Stop looking for chunks */
-			more_chunks = 0;
-			break;
-		default:
-			/* Unknown chunk, skip bytes */
-			fseek(f->file, chunk_header.size, SEEK_CUR);
+			f->data = p;
+			f->data_size = chunk_header->size < left ?
+			               chunk_header->size : left;
+			continue;
 		}
-	} while (more_chunks);
+
+		/* skip chunk, they're word aligned */
+		if (chunk_header->size + (chunk_header->size & 1) > left)
+			goto _go_truncated;
+		p += chunk_header->size + (chunk_header->size & 1);
+	}
+
+	if (f->data == NULL)
+		goto _go_truncated;
 
 	return 0;
+
+_go_truncated:
+	fprintf(stderr, "Error: '%s' is truncated\n", filename);
+_go_unmap:
+	munmap(f->map, f->map_size);
+	return -1;
+}
+
+/* request 'length' bytes from 'offset' of data to disk */
+static void
+advise_file(struct file *f, size_t offset, size_t length)
+{
+	uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+	uintptr_t start = (uintptr_t) f->data + offset;
+
+	if (offset >= f->data_size)
+		return;
+	if (length > f->data_size - offset)
+		length = f->data_size - offset;
+
+	length += start & page_mask;
+	start &= ~page_mask;
+
+	madvise((void*) start, length, MADV_WILLNEED);
+}
+
+#if !defined(TIMER_WAKEUP) && !defined(DEADLINE_WAKEUP)
+/*
+ * play a single file directly from its mapping
+ *
+ * There is nothing to mix, so frames are transferred
+ * from the file mapping to the sound device (one copy).
+ * The next periods are requested to disk ahead.
+ */
+static void
+play_file(struct snd *pcm, struct file *f, unsigned int period_size)
+{
+	size_t window = snd_frames_to_bytes(pcm, period_size) *
+	                READ_AHEAD_PERIODS;
+	size_t advised = 0;
+	size_t pos = 0;
+	unsigned int frames;
+	int tmp;
+
+	while (_keep_running) {
+		struct pollfd pfd = {pcm->fd, POLLOUT, 0};
+
+		/* keep a window requested ahead */
+		if (pos + window > advised) {
+			advise_file(f, advised, window);
+			advised += window;
+		}
+
+		frames = snd_bytes_to_frames(pcm, f->data_size - pos);
+		if (frames == 0)
+			break;
+		if (frames > period_size)
+			frames = period_size;
+
+		if (poll(&pfd, 1, -1) == -1)
+			break;
+		if (pfd.revents & POLLERR)
+			continue;
+
+		snd_sync(pcm, SND_SYNC_GET);
+
+		tmp = snd_write(pcm, f->data + pos, frames);
+		if (tmp < 0 && errno == EAGAIN)
+			continue;
+		if (tmp < 0) {
+			fprintf(stderr, "Error playing sample: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		pos += snd_frames_to_bytes(pcm, tmp);
+	}
 }
+#endif
 
 static void
 run(struct file *files,        unsigned int files_count, unsigned int card,
     unsigned int device,       unsigned int channels,    unsigned int rate,
-    unsigned int bits,         unsigned int period_size,
+    unsigned int format,       unsigned int period_size,
     unsigned int period_count, unsigned int mmap)
 {
 #if defined(TIMER_WAKEUP) || defined(DEADLINE_WAKEUP)
@@ -182,13 +373,19 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 #endif
 	struct snd pcm;
 	struct snd_config config;
-	char *buffer;
+	const void *data;
+	size_t bytes;
 	int size;
 	unsigned int frames;
+	int playing;
+	/* files being read ahead */
+	int reading = 0;
 
 	/* mix stuff */
 	int i;
-	void *mix_sum;
+	const void *mix_src[files_count];
+	struct read_ahead *mix_ra[files_count];
+	unsigned int mix_count;
 	void *mix_dst;
 
 	int tmp;
@@ -208,10 +405,7 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 	config.period_size =  period_size;
 	config.period_count = period_count;
 
-	if (bits == 32)
-		config.format = SND_FORMAT_S32_LE;
-	else if (bits == 16)
-		config.format = SND_FORMAT_S16_LE;
+	config.format =       format;
 
 #if defined(TIMER_WAKEUP) || defined(DEADLINE_WAKEUP)
 	if (snd_timer_open(&snd_timer, &pcm, &config, period_size) == -1) {
@@ -223,8 +417,6 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 	}
 
 	size = snd_frames_to_bytes(&pcm, period_size);
-	buffer = malloc(size);
-	mix_sum = malloc(size * 2);
 #if defined(TIMER_WAKEUP) || defined(DEADLINE_WAKEUP)
 	/* allocate a bigger buffer in order to handle deviations */
 	mix_dst = malloc(size * 2);
@@ -233,9 +425,27 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 #endif
 
 	printf("Channels: %u, %u Hz, %u-bits, Access %s\n",
-	       channels, rate, bits,
+	       channels, rate, snd_format_to_bytes(format) * 8,
 	       mmap ? "MMAP" : "RW");
 
+	/*
+	 * file reading is done ahead, out of the loop
+	 *
+	 * A single file is played directly from its mapping
+	 * (see play_file()).
+	 */
+#if !defined(TIMER_WAKEUP) && !defined(DEADLINE_WAKEUP)
+	if (files_count > 1)
+#endif
+	for (; reading < files_count; reading++) {
+		if (read_ahead_open(&files[reading].ra, files[reading].data,
+		                    files[reading].data_size, size,
+		                    READ_AHEAD_PERIODS) == -1) {
+			fprintf(stderr, "Unable to start reading files\n");
+			goto _cleanup;
+		}
+	}
+
 	/*
 	 * Run
 	 * ===
@@ -248,6 +458,11 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 	snd_timer_start(&snd_timer, &pcm);
 #else
 	snd_start(&pcm);
+
+	if (files_count == 1) {
+		play_file(&pcm, &files[0], period_size);
+		goto _cleanup;
+	}
 #endif
 
 	do {
@@ -276,25 +491,42 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 
 #endif /* DEADLINE_WAKEUP */
 
-		/* prepare to mix */
-		memset(mix_sum, 0, size * 2);
-		memset(mix_dst, 0, size);
+		frames = 0;
+		playing = 0;
+		mix_count = 0;
 
 		i = files_count;
 		while (i--) {
-			tmp = fread(buffer, 1, size, files[i].file);
-			if (tmp == -1) {
-				printf("fread error\n");
-				break;
+			data = read_ahead_get(&files[i].ra, &bytes);
+			if (data == NULL) {
+				/* reader is late, file is silent this time */
+				playing = 1;
+				frames = period_size;
+				continue;
 			}
 
-			frames = snd_bytes_to_frames(&pcm, tmp);
+			/* end of file, keep the buffer */
+			if (bytes == 0)
+				continue;
 
-			if (frames > 0)
-				sndmix(mix_dst, buffer, mix_sum,
-				       frames * channels, bits);
+			playing = 1;
+
+			tmp = snd_bytes_to_frames(&pcm, bytes);
+			if (tmp > frames)
+				frames = tmp;
+
+			/* last buffer of a file is padded with silence */
+			mix_src[mix_count] = data;
+			mix_ra[mix_count++] = &files[i].ra;
 		}
 
+		/* all files are mixed at once */
+		sndmix_n(mix_dst, mix_src, mix_count, period_size * channels,
+		         format);
+
+		while (mix_count--)
+			read_ahead_put(mix_ra[mix_count]);
+
 #if defined(TIMER_WAKEUP) || defined(DEADLINE_WAKEUP)
 		snd_sync(&pcm, SND_SYNC_GET | SND_SYNC_HW);
 #else
@@ -314,12 +546,12 @@ run(struct file *files,        unsigned int files_count, unsigned int card,
 				strerror(errno));
 			break;
 		}
-	} while (_keep_running && frames);
+	} while (_keep_running && playing);
 
 _cleanup:
+	while (reading--)
+		read_ahead_close(&files[reading].ra);
 	free(mix_dst);
-	free(mix_sum);
-	free(buffer);
 #if defined(TIMER_WAKEUP) || defined(DEADLINE_WAKEUP)
 	snd_timer_close(&snd_timer, &pcm);
 #else
@@ -390,8 +622,13 @@ main(int argc, char **argv)
 
 	tmp = &files[0].info;
 
+	if (sound_format(tmp) == -1) {
+		printf("Sample format is not supported\n");
+		goto _go_close_files;
+	}
+
 	run(files, files_count, card, device, tmp->channels,
-	    tmp->rate, tmp->bits_per_sample, period_size,
+	    tmp->rate, sound_format(tmp), period_size,
 	    period_count, mmap);
 
 	/* clean up */
@@ -399,7 +636,7 @@ main(int argc, char **argv)
 _go_close_files:
 	/* here if (i < files_count) at least one open has failed */
 	while (i--)
-		fclose(files[i].file);
+		close_file(&files[i]);
 	free(files);
 
 	return 0;